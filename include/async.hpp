@@ -11,6 +11,7 @@
 #include <mutex>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
 
 namespace couv 
 {
@@ -61,7 +62,7 @@ namespace couv
         struct async_deleter
         {
             void operator()(async_data* p) const {
-                uv_close(reinterpret_cast<uv_handle_t*>(&p->async_handle), [](uv_handle_t* req) {
+                close_handle(reinterpret_cast<uv_handle_t*>(&p->async_handle), [](uv_handle_t* req) {
                     delete reinterpret_cast<async_data*>(req->data);
                 });
             }
@@ -72,7 +73,7 @@ namespace couv
             data{new async_data, async_deleter{}}
         {
             data->async_handle.data = data.get();
-            uv_async_init(uv_default_loop(), &data->async_handle, [] (uv_async_t *async_handle) {
+            uv_async_init(current_loop(), &data->async_handle, [] (uv_async_t *async_handle) {
                 auto self = static_cast<async_data*>(async_handle->data);
                 if (self->co_handle) {
                     self->co_handle();
@@ -132,7 +133,7 @@ namespace couv
         struct async_deleter
         {
             void operator()(void* p) const {
-                uv_close(static_cast<uv_handle_t*>(p), [](uv_handle_t* req) {
+                close_handle(static_cast<uv_handle_t*>(p), [](uv_handle_t* req) {
                     delete reinterpret_cast<uv_async_t*>(req);
                 });
             }
@@ -142,7 +143,7 @@ namespace couv
         async() : 
             async_handle{new uv_async_t, async_deleter{}}
         {
-            uv_async_init(uv_default_loop(), async_handle.get(), [] (uv_async_t *async_handle) {
+            uv_async_init(current_loop(), async_handle.get(), [] (uv_async_t *async_handle) {
                 if (async_handle->data) {
                     std::coroutine_handle<>::from_address(async_handle->data).resume();
                 }
@@ -0,0 +1,89 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace couv
+{
+    // message assembled from slices without copying them, written with one multi buffer write
+    class buffer_chain
+    {
+    public:
+        struct slice
+        {
+            std::shared_ptr<const void> owner;  // null for borrowed memory
+            const char* data;
+            std::size_t size;
+        };
+
+        buffer_chain() = default;
+
+        // takes the string over
+        buffer_chain& append(std::string s)
+        {
+            if (!s.empty()) {
+                auto owner = std::make_shared<const std::string>(std::move(s));
+                slices.push_back({owner, owner->data(), owner->size()});
+                bytes += owner->size();
+            }
+            return *this;
+        }
+
+        // borrowed, the memory must outlive the write, as literals do
+        buffer_chain& append(std::string_view view)
+        {
+            return append(nullptr, view.data(), view.size());
+        }
+
+        buffer_chain& append(const char* literal)
+        {
+            return append(std::string_view{literal});
+        }
+
+        // shares memory kept alive by owner, such as a receive buffer taken from a reader
+        buffer_chain& append(std::shared_ptr<const void> owner, const char* data, std::size_t size)
+        {
+            if (size) {
+                slices.push_back({std::move(owner), data, size});
+                bytes += size;
+            }
+            return *this;
+        }
+
+        // shares the slices of another chain
+        buffer_chain& append(const buffer_chain& chain)
+        {
+            slices.insert(slices.end(), chain.slices.begin(), chain.slices.end());
+            bytes += chain.bytes;
+            return *this;
+        }
+
+        std::size_t size() const noexcept { return bytes; }
+        bool empty() const noexcept { return bytes == 0; }
+
+        std::span<const slice> parts() const noexcept { return slices; }
+
+        std::string to_string() const
+        {
+            std::string out;
+            out.reserve(bytes);
+            for (auto& s : slices) {
+                out.append(s.data, s.size);
+            }
+            return out;
+        }
+
+    private:
+        std::vector<slice> slices;
+        std::size_t bytes{0};
+    };
+}
@@ -0,0 +1,274 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <tcp.hpp>
+#include <task.hpp>
+#include <error_code.hpp>
+
+namespace couv
+{
+    // bytes between head and tail, received straight into the free space after tail. A mirrored
+    // ring maps its pages twice back to back so both regions are contiguous across the wrap,
+    // a plain one compacts to the front instead
+    class byte_ring
+    {
+        char* base{nullptr};
+        std::size_t capacity;
+        std::size_t head{0};
+        std::size_t tail{0};
+        bool mirrored{false};
+
+        bool map_mirrored() noexcept
+        {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+            int fd = ::memfd_create("couv_ring", MFD_CLOEXEC);
+            if (fd < 0) {
+                return false;
+            }
+            void* area = MAP_FAILED;
+            if (::ftruncate(fd, capacity) == 0) {
+                area = ::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+            if (area != MAP_FAILED) {
+                auto lower = static_cast<char*>(area);
+                constexpr int prot = PROT_READ | PROT_WRITE;
+                constexpr int flags = MAP_SHARED | MAP_FIXED;
+                if (::mmap(lower, capacity, prot, flags, fd, 0) == MAP_FAILED ||
+                    ::mmap(lower + capacity, capacity, prot, flags, fd, 0) == MAP_FAILED) {
+                    ::munmap(area, 2 * capacity);
+                    area = MAP_FAILED;
+                }
+            }
+            ::close(fd);
+            if (area == MAP_FAILED) {
+                return false;
+            }
+            base = static_cast<char*>(area);
+            return true;
+#else
+            return false;
+#endif
+        }
+
+    public:
+        // a mirrored ring rounds capacity up to whole pages, it falls back to a plain one if the
+        // mapping fails
+        byte_ring(std::size_t size, bool mirror) : capacity{size}
+        {
+            if (mirror) {
+                std::size_t page = ::sysconf(_SC_PAGESIZE);
+                capacity = (size + page - 1) / page * page;
+                mirrored = map_mirrored();
+            }
+            if (!mirrored) {
+                capacity = size;
+                base = new char[capacity];
+            }
+        }
+
+        byte_ring(const byte_ring&) = delete;
+        byte_ring& operator=(const byte_ring&) = delete;
+
+        ~byte_ring()
+        {
+#if defined(__linux__)
+            if (mirrored) {
+                ::munmap(base, 2 * capacity);
+                return;
+            }
+#endif
+            delete[] base;
+        }
+
+        std::size_t size() const noexcept { return tail - head; }
+        std::size_t max_size() const noexcept { return capacity; }
+        bool is_mirrored() const noexcept { return mirrored; }
+
+        std::string_view readable() const noexcept
+        {
+            return {base + (mirrored ? head % capacity : head), size()};
+        }
+
+        std::span<char> writable() noexcept
+        {
+            if (mirrored) {
+                return {base + tail % capacity, capacity - size()};
+            }
+            return {base + tail, capacity - tail};
+        }
+
+        // only between reads, it moves the bytes views point at
+        void compact() noexcept
+        {
+            if (!mirrored && head) {
+                std::memmove(base, base + head, size());
+                tail -= head;
+                head = 0;
+            }
+        }
+
+        void commit(std::size_t n) noexcept { tail += n; }
+
+        void consume(std::size_t n) noexcept
+        {
+            head += n;
+            if (head == tail && !mirrored) {
+                head = tail = 0;
+            }
+        }
+    };
+
+    // receive buffer policy that hands basic_reader the free space of a ring
+    class ring_buffer
+    {
+        byte_ring* ring;
+        std::span<char> claimed;
+
+    public:
+        ring_buffer(byte_ring& ring) noexcept : ring{&ring} {}
+
+        std::span<char> claim(std::size_t)
+        {
+            claimed = ring->writable();
+            return claimed;
+        }
+
+        std::span<char> held() const noexcept { return claimed; }
+
+        void release() noexcept { claimed = {}; }
+    };
+
+    // framing on top of a tcp reader. Returned views point into the ring and stay valid until
+    // the next call. Reading only runs while a call waits for bytes, so a slow consumer stops
+    // the socket instead of growing memory past max_buffer
+    class buffered_reader
+    {
+        std::unique_ptr<byte_ring> ring;
+        basic_reader<ring_buffer> reader;
+        std::size_t pending{0};
+
+        // settles what the last view covered
+        void settle() noexcept
+        {
+            ring->consume(std::exchange(pending, 0));
+        }
+
+        // the reader keeps a byte of the free space back for its terminator
+        std::size_t limit() const noexcept { return ring->max_size() - 1; }
+
+        // receives one more chunk into the ring
+        task<void, error_code> fill()
+        {
+            ring->compact();
+            if (ring->size() == limit()) {
+                co_return error_code{UV_ENOBUFS};
+            }
+            auto chunk = co_await reader;
+            if (!chunk) {
+                co_return reader.error();
+            }
+            ring->commit(reader.size());
+            co_return error_code{0};
+        }
+
+    public:
+        buffered_reader(tcp& tcp, std::size_t max_buffer = 64 * 1024, bool mirrored = false) :
+            ring{std::make_unique<byte_ring>(max_buffer + 1, mirrored)},
+            reader{tcp.read(ring_buffer{*ring})}
+        {
+        }
+
+        // exactly n bytes, UV_ENOBUFS when n can never fit
+        task<std::string_view, error_code> read_exact(std::size_t n)
+        {
+            settle();
+            if (n > limit()) {
+                co_return error_code{UV_ENOBUFS};
+            }
+            while (ring->size() < n) {
+                auto filled = co_await fill();
+                if (!filled) {
+                    co_return filled.error();
+                }
+            }
+            pending = n;
+            co_return ring->readable().substr(0, n);
+        }
+
+        // up to and including delim, UV_ENOBUFS when the buffer fills up without one
+        task<std::string_view, error_code> read_until(std::string_view delim)
+        {
+            settle();
+            std::size_t searched = 0;
+            while (true) {
+                auto data = ring->readable();
+                auto found = data.find(delim, searched);
+                if (found != std::string_view::npos) {
+                    pending = found + delim.size();
+                    co_return data.substr(0, pending);
+                }
+                if (data.size() >= delim.size()) {
+                    searched = data.size() - delim.size() + 1;
+                }
+                auto filled = co_await fill();
+                if (!filled) {
+                    co_return filled.error();
+                }
+            }
+        }
+
+        // one line without its \n or \r\n
+        task<std::string_view, error_code> readline()
+        {
+            auto line = co_await read_until("\n");
+            if (!line) {
+                co_return line.error();
+            }
+            auto view = line.value();
+            view.remove_suffix(view.size() > 1 && view[view.size() - 2] == '\r' ? 2 : 1);
+            co_return view;
+        }
+
+        // at least n bytes without consuming them, the view holds everything buffered
+        task<std::string_view, error_code> peek(std::size_t n = 1)
+        {
+            settle();
+            if (n > limit()) {
+                co_return error_code{UV_ENOBUFS};
+            }
+            while (ring->size() < n) {
+                auto filled = co_await fill();
+                if (!filled) {
+                    co_return filled.error();
+                }
+            }
+            co_return ring->readable();
+        }
+
+        // what is buffered right now, for parsers that consume by hand
+        std::string_view buffered() noexcept
+        {
+            settle();
+            return ring->readable();
+        }
+
+        void consume(std::size_t n) noexcept
+        {
+            settle();
+            ring->consume(n);
+        }
+    };
+}
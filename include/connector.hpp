@@ -10,6 +10,8 @@
 #include <memory>
 
 #include <uv.h> // libuv
+#include <scheduler.hpp>
+#include <slab.hpp>
 #include <getaddrinfo.hpp>
 #include <error_code.hpp>
 
@@ -18,9 +20,10 @@ namespace couv
     class tcp;
     class connector
     {
-        struct connector_data {
+        struct connector_data : slab_allocated<connector_data> {
             uv_connect_t req;
             std::coroutine_handle<> co_handle;
+            ready_node node;
             int status;
         };
 
@@ -28,14 +31,22 @@ namespace couv
 
     public:
 
-        connector(const tcp& tcp, const char* ip, int port);
-        connector(const tcp& tcp, const getaddrinfo&);
+        connector(const tcp& tcp, const sockaddr* addr);
+
+        // already completed with status
+        connector(error_code status) : data{std::make_unique<connector_data>()}
+        {
+            data->status = status;
+        }
 
         connector(connector&&) = default;
         connector& operator=(connector&&) = default;
 
         ~connector()
         {
+            if (data) {
+                data->node.cancel();
+            }
             [[unlikely]] if (data && data->status == 1) {
                 data->req.cb = [](uv_connect_t* req, int) {
                     delete static_cast<connector_data*>(req->data);
@@ -6,11 +6,25 @@
 #pragma once
 
 #include <task.hpp>
+#include <scheduler.hpp>
 #include <signal.hpp>
+#include <fs_event.hpp>
+#include <fs_poll.hpp>
 #include <idle.hpp>
+#include <poll.hpp>
 #include <timer.hpp>
 #include <tcp.hpp>
+#include <pipe.hpp>
+#include <process.hpp>
+#include <pipe_through.hpp>
+#include <buffered_reader.hpp>
+#include <sync.hpp>
+#include <rate_limiter.hpp>
+#include <shutdown.hpp>
 #include <work.hpp>
+#include <work_stream.hpp>
+#include <parallel.hpp>
+#include <rcu.hpp>
 #include <async.hpp>
 #include <optional.hpp>
 #include <expect.hpp>
@@ -19,8 +33,17 @@ namespace couv
 {    
     int loop()
     {
-        int ret = uv_run(uv_default_loop(), UV_RUN_DEFAULT);
-        uv_loop_close(uv_default_loop());
+        auto loop = uv_default_loop();
+        int ret = uv_run(loop, UV_RUN_DEFAULT);
+        if (auto scheduler = static_cast<event_loop*>(loop->data)) {
+            scheduler->close_hooks();
+        }
+        // handles still open, the scheduler's own among them, are closed here and freed by their
+        // owners later, requests in flight get to finish first
+        do {
+            close_all(loop);
+            uv_run(loop, UV_RUN_DEFAULT);
+        } while (uv_loop_close(loop) == UV_EBUSY);
         return ret;
     }
 
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <exception>
+#include <type_traits>
 #include <expect.hpp>
 
 namespace couv {
@@ -26,11 +28,15 @@ namespace couv {
 
         void throw_if() const 
         {
-            if (code) throw code;
+            if (code) throw_error(code);
         }
 
-        constexpr bool await_ready() const noexcept { return true; }
-        constexpr void await_suspend(std::coroutine_handle<>) const noexcept {}
+        constexpr bool await_ready() const noexcept { return code == 0; }
+        constexpr bool await_suspend(std::coroutine_handle<>) const noexcept { return false; }
+        // a coroutine whose errors are exceptions gets the code thrown, so its try/catch still sees it
+        template <failable_promise<int> P>
+            requires (!std::is_same_v<typename P::error_type, std::exception_ptr>)
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept { return h.promise().fail(h, code); }
         void await_resume() const { throw_if(); }
     };
 
@@ -1,10 +1,72 @@
 #pragma once
 
+#include <coroutine>
 #include <variant>
 #include <exception>
+#include <new>
+#include <type_traits>
+
+#include <uv.h> // libuv
 
 namespace couv {
 
+template <typename E>
+[[noreturn]] void throw_error(const E& e)
+{
+#if defined(__cpp_exceptions)
+    if constexpr (std::is_same_v<std::exception_ptr, E>)
+        std::rethrow_exception(e);
+    else
+        throw e;
+#else
+    std::terminate();
+#endif
+}
+
+// converts an error to the error type of the awaiting coroutine,
+// only exception_ptr needs an allocation
+template <typename E, typename F>
+E to_error(F&& f) noexcept
+{
+    if constexpr (std::is_constructible_v<E, F&&>)
+        return E(std::forward<F>(f));
+    else
+        return std::make_exception_ptr(std::forward<F>(f));
+}
+
+// the error for an exception escaping a coroutine. Error types built from a code keep a thrown
+// code, std::bad_alloc becomes UV_ENOMEM and anything else UV_UNKNOWN. Error types that are
+// neither exception_ptr nor built from a code terminate
+template <typename E>
+E current_error() noexcept
+{
+    if constexpr (std::is_same_v<std::exception_ptr, E>)
+        return std::current_exception();
+    else if constexpr (std::is_constructible_v<E, int>) {
+#if defined(__cpp_exceptions)
+        try {
+            throw;
+        } catch (const E& e) {
+            return e;
+        } catch (int code) {
+            return E(code);
+        } catch (const std::bad_alloc&) {
+            return E(UV_ENOMEM);
+        } catch (...) {
+        }
+#endif
+        return E(UV_UNKNOWN);
+    }
+    else
+        std::terminate();
+}
+
+// promises that can end early with an error instead of throwing
+template <typename P, typename F>
+concept failable_promise = requires(P& p, std::coroutine_handle<P> h, F f) {
+    { p.fail(h, f) } -> std::same_as<std::coroutine_handle<>>;
+};
+
 template <typename T = void, typename E = std::exception_ptr>
 class expect
 {
@@ -72,48 +134,32 @@ public:
     { 
         if (var.index() == 0) 
             return get<0>(var); 
-        else {
-            if constexpr (std::is_same_v<std::exception_ptr, E>)
-                std::rethrow_exception(get<1>(var)); 
-            else
-                throw get<1>(var);
-        }
+        else
+            throw_error(get<1>(var));
     }
 
     const T& value() const&  
     { 
         [[likely]] if (var.index() == 0) 
             return get<0>(var); 
-        else {
-            if constexpr (std::is_same_v<std::exception_ptr, E>)
-                std::rethrow_exception(get<1>(var)); 
-            else
-                throw get<1>(var);
-        }
+        else
+            throw_error(get<1>(var));
     }
     
     T&& value() &&
     { 
         [[likely]] if (var.index() == 0) 
             return get<0>(std::move(var)); 
-        else {
-            if constexpr (std::is_same_v<std::exception_ptr, E>)
-                std::rethrow_exception(get<1>(var)); 
-            else
-                throw get<1>(var);
-        }
+        else
+            throw_error(get<1>(var));
     }
 
     const T&& value() const&&  
     { 
         [[likely]] if (var.index() == 0) 
             return get<0>(std::move(var)); 
-        else {
-            if constexpr (std::is_same_v<std::exception_ptr, E>)
-                std::rethrow_exception(get<1>(var)); 
-            else
-                throw get<1>(var);
-        }
+        else
+            throw_error(get<1>(var));
     }
 
     constexpr bool has_value() const noexcept { return var.index() == 0; }
@@ -121,6 +167,8 @@ public:
 
     constexpr bool await_ready() const noexcept { return has_value(); }
     constexpr void await_suspend(std::coroutine_handle<> h) const noexcept { h.destroy(); }
+    template <failable_promise<const E&> P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept { return h.promise().fail(h, error()); }
     const T& await_resume() const& noexcept { return *get_if<0>(&var); }
     T&& await_resume() && noexcept { return std::move(*get_if<0>(&var)); }
 };
@@ -163,12 +211,8 @@ public:
 
     void value() const 
     { 
-        [[unlikely]] if (var.index() == 1) {
-            if constexpr (std::is_same_v<std::exception_ptr, E>)
-                std::rethrow_exception(get<1>(var)); 
-            else
-                throw get<1>(var);
-        }
+        [[unlikely]] if (var.index() == 1)
+            throw_error(get<1>(var));
     }
 
     const E& error() const {
@@ -180,6 +224,8 @@ public:
 
     constexpr bool await_ready() const noexcept { return has_value(); }
     constexpr void await_suspend(std::coroutine_handle<> h) const noexcept { h.destroy(); }
+    template <failable_promise<const E&> P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) const noexcept { return h.promise().fail(h, error()); }
     constexpr void await_resume() const noexcept {}
 };
 
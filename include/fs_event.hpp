@@ -0,0 +1,183 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <error_code.hpp>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
+
+namespace couv
+{
+    // events is UV_RENAME, UV_CHANGE or both when a path changed several times in one batch
+    struct fs_change
+    {
+        std::string path;
+        int events;
+    };
+
+    namespace detail
+    {
+        // collects changes and hands them out once the watched paths stay quiet for debounce ms.
+        // A burst that never goes quiet is still handed out after 10 debounce periods
+        struct change_batch
+        {
+            uv_timer_t timer_handle;
+            std::vector<fs_change> pending;
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+            uint64_t debounce;
+            uint64_t first{0};
+            error_code failed{0};
+            error_code status{0};
+            bool ready{false};
+
+            change_batch(uint64_t debounce) noexcept : debounce{debounce}
+            {
+                uv_timer_init(current_loop(), &timer_handle);
+                timer_handle.data = this;
+            }
+
+            void wake()
+            {
+                [[likely]] if (co_handle) {
+                    node.resume(timer_handle.loop, std::exchange(co_handle, nullptr));
+                }
+            }
+
+            void add(std::string_view path, int events)
+            {
+                uint64_t now = uv_now(timer_handle.loop);
+                if (pending.empty()) {
+                    first = now;
+                }
+                auto same = std::find_if(pending.begin(), pending.end(), [&](auto& c) { return c.path == path; });
+                if (same != pending.end()) {
+                    same->events |= events;
+                } else {
+                    pending.push_back({std::string{path}, events});
+                }
+                if (ready) {
+                    return;
+                }
+                uint64_t limit = std::max(first + 10 * debounce, now);
+                uv_timer_start(&timer_handle, [](uv_timer_t* timer_handle) {
+                    auto batch = static_cast<change_batch*>(timer_handle->data);
+                    batch->ready = true;
+                    batch->wake();
+                }, std::min(now + debounce, limit) - now, 0);
+            }
+
+            void fail(error_code err)
+            {
+                failed = err;
+                ready = true;
+                uv_timer_stop(&timer_handle);
+                wake();
+            }
+
+            bool await_ready() const noexcept { return ready; }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept { co_handle = h; }
+
+            std::vector<fs_change> await_resume()
+            {
+                co_handle = nullptr;
+                // changes collected before a failure come first, the empty batch after them has the error.
+                // A later batch clears it again
+                ready = failed && !pending.empty();
+                status = 0;
+                if (!ready) {
+                    std::swap(status, failed);
+                }
+                return std::exchange(pending, {});
+            }
+        };
+    }
+
+    // inotify and friends. Every co_await gives the changes of one quiet period, an empty batch
+    // means the watch failed and error() tells why until the next batch
+    class fs_event
+    {
+        struct fs_event_data : detail::change_batch, slab_allocated<fs_event_data> {
+            uv_fs_event_t event_handle;
+            int open{2};
+
+            fs_event_data(uint64_t debounce) noexcept : detail::change_batch{debounce} {}
+        };
+
+        struct fs_event_deleter
+        {
+            void operator()(fs_event_data* data) const noexcept {
+                data->node.cancel();
+                auto closed = [](uv_handle_t* handle) {
+                    auto data = static_cast<fs_event_data*>(static_cast<detail::change_batch*>(handle->data));
+                    if (--data->open == 0) {
+                        delete data;
+                    }
+                };
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->event_handle), closed);
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->timer_handle), closed);
+            }
+        };
+
+        std::unique_ptr<fs_event_data, fs_event_deleter> data;
+
+    public:
+        fs_event(uint64_t debounce = 10) : data{new fs_event_data{debounce}, fs_event_deleter{}}
+        {
+            uv_fs_event_init(current_loop(), &data->event_handle);
+            data->event_handle.data = static_cast<detail::change_batch*>(data.get());
+        }
+
+        fs_event(const char* path, unsigned flags = 0, uint64_t debounce = 10) : fs_event(debounce)
+        {
+            // nobody sees the result here, the first co_await gives the empty batch instead
+            if (auto err = start(path, flags)) {
+                data->fail(err);
+            }
+        }
+
+        // changes inside a directory are reported by their name in it
+        error_code start(const char* path, unsigned flags = 0) {
+            return uv_fs_event_start(&data->event_handle,
+                [](uv_fs_event_t* event_handle, const char* filename, int events, int status) {
+                    auto batch = static_cast<detail::change_batch*>(event_handle->data);
+                    if (status < 0) {
+                        batch->fail(status);
+                        return;
+                    }
+                    char path[1024];
+                    std::size_t size = sizeof(path);
+                    if (!filename && uv_fs_event_getpath(event_handle, path, &size) == 0) {
+                        filename = path;
+                    }
+                    batch->add(filename ? filename : "", events);
+                }, path, flags);
+        }
+
+        error_code stop() {
+            uv_timer_stop(&data->timer_handle);
+            return uv_fs_event_stop(&data->event_handle);
+        }
+
+        error_code error() const noexcept { return data->status; }
+
+        bool await_ready() const noexcept { return data->await_ready(); }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->await_suspend(h); }
+        std::vector<fs_change> await_resume() { return data->await_resume(); }
+    };
+}
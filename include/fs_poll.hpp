@@ -0,0 +1,94 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <error_code.hpp>
+#include <fs_event.hpp>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <slab.hpp>
+
+namespace couv
+{
+    // stat polling for file systems without change notification, such as network mounts.
+    // Each stat is a short thread pool request, no thread is held between polls.
+    // A path that disappears is reported as UV_RENAME, any other stat change as UV_CHANGE
+    class fs_poll
+    {
+        struct fs_poll_data : detail::change_batch, slab_allocated<fs_poll_data> {
+            uv_fs_poll_t poll_handle;
+            std::string path;
+            int open{2};
+
+            fs_poll_data(uint64_t debounce) noexcept : detail::change_batch{debounce} {}
+        };
+
+        struct fs_poll_deleter
+        {
+            void operator()(fs_poll_data* data) const noexcept {
+                data->node.cancel();
+                auto closed = [](uv_handle_t* handle) {
+                    auto data = static_cast<fs_poll_data*>(static_cast<detail::change_batch*>(handle->data));
+                    if (--data->open == 0) {
+                        delete data;
+                    }
+                };
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->poll_handle), closed);
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->timer_handle), closed);
+            }
+        };
+
+        std::unique_ptr<fs_poll_data, fs_poll_deleter> data;
+
+    public:
+        fs_poll(uint64_t debounce = 10) : data{new fs_poll_data{debounce}, fs_poll_deleter{}}
+        {
+            uv_fs_poll_init(current_loop(), &data->poll_handle);
+            data->poll_handle.data = static_cast<detail::change_batch*>(data.get());
+        }
+
+        fs_poll(const char* path, unsigned interval, uint64_t debounce = 10) : fs_poll(debounce)
+        {
+            if (auto err = start(path, interval)) {
+                data->fail(err);
+            }
+        }
+
+        // interval in ms between stat calls
+        error_code start(const char* path, unsigned interval) {
+            data->path = path;
+            return uv_fs_poll_start(&data->poll_handle,
+                [](uv_fs_poll_t* poll_handle, int status, const uv_stat_t*, const uv_stat_t*) {
+                    auto batch = static_cast<detail::change_batch*>(poll_handle->data);
+                    auto& path = static_cast<fs_poll_data*>(batch)->path;
+                    if (status == UV_ENOENT) {
+                        batch->add(path, UV_RENAME);
+                    } else if (status < 0) {
+                        batch->fail(status);
+                    } else {
+                        batch->add(path, UV_CHANGE);
+                    }
+                }, path, interval);
+        }
+
+        error_code stop() {
+            uv_timer_stop(&data->timer_handle);
+            return uv_fs_poll_stop(&data->poll_handle);
+        }
+
+        error_code error() const noexcept { return data->status; }
+
+        bool await_ready() const noexcept { return data->await_ready(); }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->await_suspend(h); }
+        std::vector<fs_change> await_resume() { return data->await_resume(); }
+    };
+}
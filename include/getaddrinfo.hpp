@@ -4,6 +4,9 @@
 #include <memory>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
 
 namespace couv
 {
@@ -11,9 +14,10 @@ namespace couv
     class getaddrinfo
     {
         friend class connector;
-        struct getaddrinfo_data {
+        struct getaddrinfo_data : slab_allocated<getaddrinfo_data> {
             uv_getaddrinfo_t getaddrinfo_handle;
             std::coroutine_handle<> co_handle;
+            ready_node node;
             bool ready{false};
             int status;
         };
@@ -25,7 +29,7 @@ namespace couv
             data{std::make_unique<getaddrinfo_data>()}
         {
             data->getaddrinfo_handle.data = data.get();
-            uv_getaddrinfo(uv_default_loop(), &data->getaddrinfo_handle, [](uv_getaddrinfo_t *getaddrinfo_handle, int status, struct addrinfo *res) {
+            uv_getaddrinfo(current_loop(), &data->getaddrinfo_handle, [](uv_getaddrinfo_t *getaddrinfo_handle, int status, struct addrinfo *res) {
                 auto data = static_cast<getaddrinfo_data*>(getaddrinfo_handle->data);
                 if (status == UV_ECANCELED) {
                     delete data;
@@ -34,7 +38,7 @@ namespace couv
                 data->ready = true;
                 data->status = status;
                 [[likely]] if (data->co_handle) {
-                    data->co_handle();
+                    data->node.resume(getaddrinfo_handle->loop, std::exchange(data->co_handle, nullptr));
                 }
             }, node, service, hints);
         }
@@ -51,9 +55,20 @@ namespace couv
             return data->status;
         };
 
+        // first resolved address, null until resolved or on failure
+        const sockaddr* address() const noexcept
+        {
+            auto info = data->getaddrinfo_handle.addrinfo;
+            if (!data->ready || data->status != 0 || !info) {
+                return nullptr;
+            }
+            return info->ai_addr;
+        }
+
         ~getaddrinfo()
         {
             if (data) {
+                data->node.cancel();
                 uv_freeaddrinfo(data->getaddrinfo_handle.addrinfo);
                 if (uv_cancel(reinterpret_cast<uv_req_t*>(&data->getaddrinfo_handle)) == 0) {
                     data.release();
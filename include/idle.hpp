@@ -9,23 +9,29 @@
 #include <iostream>
 #include <memory>
 #include <error_code.hpp>
+#include <tick.hpp>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
 
 namespace couv
 {
     class idle
     {
-        struct idle_data {
+        struct idle_data : slab_allocated<idle_data> {
             uv_idle_t idle_handle;
             std::coroutine_handle<> co_handle;
+            ready_node node;
             int ready{0};
         };
 
         struct idle_deleter
         {
             void operator()(idle_data* data) const noexcept {
-                uv_close(reinterpret_cast<uv_handle_t*>(&data->idle_handle), [](uv_handle_t* idle_handle) {
+                data->node.cancel();
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->idle_handle), [](uv_handle_t* idle_handle) {
                     delete static_cast<idle_data*>(idle_handle->data);
                 });
             }
@@ -37,7 +43,7 @@ namespace couv
         idle(bool autostart = false) : 
             data{new idle_data{}, idle_deleter{}}
         {
-            uv_idle_init(uv_default_loop(), &data->idle_handle);
+            uv_idle_init(current_loop(), &data->idle_handle);
             data->idle_handle.data = data.get();
             if (autostart) {
                 start();
@@ -52,7 +58,7 @@ namespace couv
                 auto data = static_cast<idle_data*>(idle_handle->data);
                 ++data->ready;
                 [[likely]] if (data->co_handle) {
-                    data->co_handle();
+                    data->node.resume(idle_handle->loop, std::exchange(data->co_handle, nullptr));
                 }
             });
         }
@@ -73,5 +79,9 @@ namespace couv
             data->co_handle = nullptr;
             --data->ready; 
         };
+
+        tick_awaiter<idle_data> ticks() noexcept {
+            return {*data, data->idle_handle.loop};
+        }
     };    
 }
\ No newline at end of file
@@ -10,6 +10,8 @@
 #include <memory>
 
 #include <uv.h> // libuv
+#include <scheduler.hpp>
+#include <error_code.hpp>
 
 namespace couv
 {
@@ -18,19 +20,25 @@ namespace couv
     {
         std::shared_ptr<uv_stream_t> stream;
         std::coroutine_handle<> co_handle;
+        ready_node node;
         int status;
         bool ready;
 
     public:
         listner(const tcp& tcp, int backlog);
 
+        // already failed with status
+        listner(error_code status) : status{status}, ready{true} {}
+
         listner(listner&& l) :
             stream{std::move(l.stream)},
             co_handle{std::move(l.co_handle)},
             status{l.status},
             ready{l.ready}
         {
-            stream->data = this;
+            if (stream) {
+                stream->data = this;
+            }
         }
 
         bool await_ready() const { 
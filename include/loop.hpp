@@ -0,0 +1,85 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <unordered_map>
+
+#include <uv.h> // libuv
+
+namespace couv
+{
+    // loop driven by this thread, null on threads that use the default loop
+    inline thread_local uv_loop_t* running_loop = nullptr;
+
+    inline uv_loop_t* current_loop() noexcept
+    {
+        return running_loop ? running_loop : uv_default_loop();
+    }
+
+    namespace detail
+    {
+        // a handle close_all closed, and the close callback its owner asked for since
+        struct walked_handle
+        {
+            uv_close_cb close_cb{nullptr};
+            bool closed{false};
+        };
+
+        // only the loop's thread closes its handles, so one table per thread is enough
+        inline std::unordered_map<uv_handle_t*, walked_handle>& walked() noexcept
+        {
+            static thread_local std::unordered_map<uv_handle_t*, walked_handle> handles;
+            return handles;
+        }
+
+        inline void walk_close(uv_handle_t* handle) noexcept
+        {
+            auto found = walked().find(handle);
+            if (found == walked().end()) {
+                return;
+            }
+            if (auto close_cb = found->second.close_cb) {
+                walked().erase(found);
+                close_cb(handle);
+            } else {
+                found->second.closed = true;
+            }
+        }
+    }
+
+    // closes every handle of loop that is not closing yet, so uv_loop_close can succeed while
+    // tasks nobody destroyed still hold handles. Their owners free them later through close_handle
+    inline void close_all(uv_loop_t* loop = current_loop())
+    {
+        uv_walk(loop, [](uv_handle_t* handle, void*) {
+            if (!uv_is_closing(handle)) {
+                detail::walked()[handle] = {};
+                uv_close(handle, detail::walk_close);
+            }
+        }, nullptr);
+    }
+
+    // uv_close for owners, close_cb still runs exactly once when close_all got to the handle first
+    inline void close_handle(uv_handle_t* handle, uv_close_cb close_cb) noexcept
+    {
+        if (!uv_is_closing(handle)) {
+            uv_close(handle, close_cb);
+            return;
+        }
+        auto found = detail::walked().find(handle);
+        if (found == detail::walked().end()) {
+            return;
+        }
+        if (!found->second.closed) {
+            found->second.close_cb = close_cb;
+            return;
+        }
+        detail::walked().erase(found);
+        if (close_cb) {
+            close_cb(handle);
+        }
+    }
+}
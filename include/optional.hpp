@@ -9,7 +9,18 @@
 #include <optional>
 #include <task.hpp>
 
+#include <uv.h> // libuv
+
 namespace couv {
+
+    template <typename E>
+    E empty_optional_error() noexcept
+    {
+        if constexpr (std::is_same_v<std::exception_ptr, E>)
+            return std::make_exception_ptr(std::bad_optional_access{});
+        else
+            return E(UV_ENODATA);
+    }
     
     template <typename T>
     class optional_promise {
@@ -55,10 +66,9 @@ namespace couv {
         constexpr bool await_ready() const noexcept { return opt.has_value(); }
         template <typename U>
         constexpr void await_suspend(std::coroutine_handle<optional_promise<U>> h) const noexcept { h.destroy(); }
-        template <typename U>
-        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise<U>> h) const noexcept {
-            h.promise().return_value(std::make_exception_ptr(std::bad_optional_access{}));
-            return h.promise().continuation();
+        template <typename U, typename E>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise<U, E>> h) const noexcept {
+            return h.promise().fail(h, empty_optional_error<E>());
         }
         constexpr const T& await_resume() const noexcept { return *opt; }
     };
@@ -72,11 +82,9 @@ namespace couv {
         constexpr bool await_ready() const noexcept { return opt.has_value(); }
         template <typename U>
         constexpr void await_suspend(std::coroutine_handle<optional_promise<U>> h) const noexcept { h.destroy(); }
-        template <typename U>
-        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise<U>> h) const noexcept 
-        {
-            h.promise().return_value(std::make_exception_ptr(std::bad_optional_access{}));
-            return h.promise().continuation();
+        template <typename U, typename E>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<task_promise<U, E>> h) const noexcept {
+            return h.promise().fail(h, empty_optional_error<E>());
         }
         constexpr T&& await_resume() noexcept { return *std::move(opt); }
     };
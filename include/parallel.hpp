@@ -0,0 +1,281 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <ranges>
+#include <utility>
+#include <vector>
+#include <error_code.hpp>
+#include <expect.hpp>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+
+namespace couv
+{
+    namespace detail
+    {
+        // libuv sizes its pool from the same variable, 4 threads unless set
+        inline std::size_t pool_size() noexcept
+        {
+            static const std::size_t size = [] {
+                const char* value = std::getenv("UV_THREADPOOL_SIZE");
+                long n = value ? std::atol(value) : 4;
+                return static_cast<std::size_t>(std::clamp(n, 1L, 1024L));
+            }();
+            return size;
+        }
+
+        // one work request per pool thread at most, each claims chunks from a shared cursor until
+        // the range runs out. Chunks start at a share of what is left and shrink towards grain as
+        // it drains, so early chunks are cheap to hand out and the last ones still balance
+        template <typename Body>
+        struct parallel_state
+        {
+            Body body;
+            std::vector<uv_work_t> requests;
+            std::size_t size;
+            std::size_t grain;
+            std::atomic<std::size_t> next{0};
+            std::atomic<bool> stopped{false};
+            std::atomic<bool> failed{false};
+            std::atomic<std::size_t> running{0};
+            std::exception_ptr error;
+            std::size_t pending;
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+            bool cancelled{false};
+            bool orphaned{false};
+
+            parallel_state(Body body, std::size_t size, std::size_t chunk) :
+                body{std::move(body)}, size{size}
+            {
+                std::size_t threads = pool_size();
+                grain = chunk ? chunk : std::max<std::size_t>(1, size / (threads * 64));
+                pending = std::min(threads, (size + grain - 1) / grain);
+                requests.resize(pending);
+                this->body.prepare(pending);
+            }
+
+            bool claim(std::size_t& begin, std::size_t& end) noexcept
+            {
+                std::size_t at = next.load(std::memory_order_relaxed);
+                // not relaxed, so a stop that finds no chunk running also keeps new ones from starting
+                while (at < size && !stopped.load()) {
+                    std::size_t share = std::max(grain, (size - at) / (2 * requests.size()));
+                    std::size_t upto = std::min(size, at + share);
+                    if (next.compare_exchange_weak(at, upto, std::memory_order_relaxed)) {
+                        begin = at;
+                        end = upto;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void start(uv_loop_t* loop)
+            {
+                for (auto& request : requests) {
+                    request.data = this;
+                    uv_queue_work(loop, &request, [](uv_work_t* request) {
+                        auto state = static_cast<parallel_state*>(request->data);
+                        std::size_t slot = request - state->requests.data();
+                        std::size_t begin, end;
+                        state->running.fetch_add(1);
+                        try {
+                            while (state->claim(begin, end)) {
+                                state->body.run(slot, begin, end);
+                            }
+                        } catch (...) {
+                            if (!state->failed.exchange(true)) {
+                                state->error = std::current_exception();
+                            }
+                            state->stopped = true;
+                        }
+                        if (state->running.fetch_sub(1) == 1) {
+                            state->running.notify_all();
+                        }
+                    },
+                    [](uv_work_t* request, int) {
+                        // the coroutine hears once, after the last request is back on the loop
+                        auto state = static_cast<parallel_state*>(request->data);
+                        if (--state->pending) {
+                            return;
+                        }
+                        if (state->orphaned) {
+                            delete state;
+                            return;
+                        }
+                        if (state->co_handle) {
+                            state->node.resume(request->loop, std::exchange(state->co_handle, nullptr));
+                        }
+                    });
+                }
+            }
+
+            // requests a pool thread has not picked up yet never run
+            void stop() noexcept
+            {
+                stopped = true;
+                for (auto& request : requests) {
+                    uv_cancel(reinterpret_cast<uv_req_t*>(&request));
+                }
+            }
+        };
+
+        template <typename Body>
+        struct parallel_deleter
+        {
+            void operator()(parallel_state<Body>* state) const noexcept {
+                state->node.cancel();
+                if (!state->pending) {
+                    delete state;
+                    return;
+                }
+                state->orphaned = true;
+                state->stop();
+                // the body may refer to the frame that is going away, so running chunks finish first
+                for (auto n = state->running.load(); n; n = state->running.load()) {
+                    state->running.wait(n);
+                }
+            }
+        };
+
+        template <typename View, typename F>
+        struct for_body
+        {
+            View view;
+            F fn;
+
+            void prepare(std::size_t) {}
+
+            void run(std::size_t, std::size_t begin, std::size_t end)
+            {
+                auto first = std::ranges::begin(view);
+                for (std::size_t i = begin; i < end; ++i) {
+                    fn(first[i]);
+                }
+            }
+        };
+
+        // every request folds its chunks into its own partial, merged on the loop at the end
+        template <typename View, typename T, typename F, typename Combine>
+        struct reduce_body
+        {
+            View view;
+            T identity;
+            F fn;
+            Combine combine;
+            std::vector<T> partials{};
+
+            void prepare(std::size_t workers) { partials.assign(workers, identity); }
+
+            void run(std::size_t slot, std::size_t begin, std::size_t end)
+            {
+                auto first = std::ranges::begin(view);
+                T& acc = partials[slot];
+                for (std::size_t i = begin; i < end; ++i) {
+                    acc = fn(std::move(acc), first[i]);
+                }
+            }
+        };
+    }
+
+    // in flight from construction on, destroying it cancels what has not started and blocks
+    // until the chunks already running are done, at most one chunk per pool thread
+    template <typename Body>
+    class basic_parallel
+    {
+    protected:
+        std::unique_ptr<detail::parallel_state<Body>, detail::parallel_deleter<Body>> state;
+
+        // an exception from the body surfaces in the awaiting coroutine
+        error_code settle()
+        {
+            if (state->error) {
+                std::rethrow_exception(state->error);
+            }
+            return state->cancelled ? UV_ECANCELED : 0;
+        }
+
+    public:
+        basic_parallel(Body body, std::size_t size, std::size_t chunk) :
+            state{new detail::parallel_state<Body>{std::move(body), size, chunk}, {}}
+        {
+            state->start(current_loop());
+        }
+
+        // chunks already running finish, the rest are skipped and co_await gives UV_ECANCELED
+        void cancel() noexcept
+        {
+            if (state->pending) {
+                state->cancelled = true;
+                state->stop();
+            }
+        }
+
+        bool await_ready() const noexcept { return !state->pending; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { state->co_handle = h; }
+    };
+
+    template <typename View, typename F>
+    class parallel_for_op : public basic_parallel<detail::for_body<View, F>>
+    {
+    public:
+        using basic_parallel<detail::for_body<View, F>>::basic_parallel;
+
+        error_code await_resume() { return this->settle(); }
+    };
+
+    template <typename View, typename T, typename F, typename Combine>
+    class parallel_reduce_op : public basic_parallel<detail::reduce_body<View, T, F, Combine>>
+    {
+    public:
+        using basic_parallel<detail::reduce_body<View, T, F, Combine>>::basic_parallel;
+
+        expect<T, error_code> await_resume()
+        {
+            if (auto err = this->settle()) {
+                return {std::in_place, err};
+            }
+            auto& body = this->state->body;
+            T result = std::move(body.identity);
+            for (auto& partial : body.partials) {
+                result = body.combine(std::move(result), std::move(partial));
+            }
+            return result;
+        }
+    };
+
+    // calls fn on every element of a random access range from the thread pool. chunk is the
+    // smallest number of elements handed out at once, 0 picks one from the range size
+    template <std::ranges::random_access_range R, typename F>
+    auto parallel_for(R&& range, std::size_t chunk, F fn)
+    {
+        using view = std::views::all_t<R>;
+        std::size_t size = std::ranges::size(range);
+        return parallel_for_op<view, F>{{std::views::all(std::forward<R>(range)), std::move(fn)}, size, chunk};
+    }
+
+    // folds the range with fn(acc, element) per chunk and merges the partials with combine,
+    // which must be associative and commutative. identity is the neutral element, e.g. 0 for a sum
+    template <std::ranges::random_access_range R, typename T, typename F, typename Combine>
+    auto parallel_reduce(R&& range, std::size_t chunk, T identity, F fn, Combine combine)
+    {
+        using view = std::views::all_t<R>;
+        std::size_t size = std::ranges::size(range);
+        return parallel_reduce_op<view, T, F, Combine>{
+            {std::views::all(std::forward<R>(range)), std::move(identity), std::move(fn), std::move(combine)},
+            size, chunk};
+    }
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <reader.hpp>
+#include <writer.hpp>
+#include <error_code.hpp>
+
+namespace couv
+{
+    // a pipe or unix socket stream, read and written the same way as tcp
+    class pipe
+    {
+        std::shared_ptr<uv_pipe_t> handle;
+        friend class process;
+        template <typename BufferPolicy>
+        friend class basic_reader;
+        friend class writer;
+
+        struct pipe_deleter
+        {
+            void operator()(void* p) const {
+                close_handle(static_cast<uv_handle_t*>(p), [](uv_handle_t* handle) {
+                    delete reinterpret_cast<uv_pipe_t*>(handle);
+                });
+            }
+        };
+
+    public:
+        pipe(bool ipc = false) : handle{new uv_pipe_t, pipe_deleter{}}
+        {
+            uv_pipe_init(current_loop(), handle.get(), ipc);
+        }
+
+        pipe(const pipe&) = delete;
+        pipe& operator=(const pipe&) = delete;
+        pipe(pipe&&) = default;
+        pipe& operator=(pipe&&) = default;
+
+        error_code open(uv_file fd) noexcept
+        {
+            return uv_pipe_open(handle.get(), fd);
+        }
+
+        // lets go of the handle, it closes once readers and queued writes are done with it.
+        // Closing a child's stdin this way is how it sees the end of its input
+        void close() noexcept
+        {
+            handle.reset();
+        }
+
+        template <typename BufferPolicy = shared_buffer>
+        basic_reader<BufferPolicy> read(BufferPolicy policy = {}) {
+            basic_reader<BufferPolicy> r{*this, std::move(policy)};
+            r.start();
+            return r;
+        }
+
+        writer write(std::string data)
+        {
+            writer w{*this};
+            w.write(std::move(data));
+            return w;
+        }
+
+        writer write(buffer_chain chain)
+        {
+            writer w{*this};
+            w.write(std::move(chain));
+            return w;
+        }
+    };
+
+    template <typename BufferPolicy>
+    basic_reader<BufferPolicy>::basic_reader(const pipe& pipe, BufferPolicy policy) :
+        stream{std::reinterpret_pointer_cast<uv_stream_t>(pipe.handle)},
+        policy{std::move(policy)}
+    {
+        stream->data = this;
+    }
+
+    inline writer::writer(const pipe& pipe) :
+        data{new writer_data{}}
+    {
+        data->stream = std::reinterpret_pointer_cast<uv_stream_t>(pipe.handle);
+        data->write_handle.data = data.get();
+    }
+}
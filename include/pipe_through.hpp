@@ -0,0 +1,199 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <uv.h> // libuv
+#include <tcp.hpp>
+#include <poll.hpp>
+#include <task.hpp>
+#include <timer.hpp>
+#include <error_code.hpp>
+
+namespace couv
+{
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+    namespace detail
+    {
+        struct splice_fds
+        {
+            int in{-1};
+            int out{-1};
+            int pipe[2]{-1, -1};
+
+            ~splice_fds()
+            {
+                for (int fd : {in, out, pipe[0], pipe[1]}) {
+                    if (fd >= 0) {
+                        ::close(fd);
+                    }
+                }
+            }
+        };
+
+        inline error_code last_error() noexcept
+        {
+            return uv_translate_sys_error(errno);
+        }
+
+        // once bytes moved the caller can not start over with a reader, EINVAL is a plain failure then
+        inline error_code splice_error(uint64_t total, std::size_t pending) noexcept
+        {
+            error_code err = last_error();
+            if (err == UV_EINVAL && (total || pending)) {
+                return UV_EIO;
+            }
+            return err;
+        }
+
+        // moves bytes socket to pipe to socket inside the kernel. The sockets are dup'ed so they can be
+        // polled next to the handles libuv owns; UV_EINVAL before any byte moved means splice does not apply
+        inline task<uint64_t, error_code> splice_relay(int from, int to)
+        {
+            constexpr int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+            constexpr int budget = 16;
+
+            splice_fds fds;
+            fds.in = ::fcntl(from, F_DUPFD_CLOEXEC, 0);
+            fds.out = ::fcntl(to, F_DUPFD_CLOEXEC, 0);
+            if (fds.in < 0 || fds.out < 0 || ::pipe2(fds.pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+                co_return last_error();
+            }
+            std::size_t capacity = std::max(::fcntl(fds.pipe[1], F_GETPIPE_SZ), 4096);
+
+            poll readable{fds.in};
+            poll writable{fds.out};
+            uint64_t total = 0;
+            std::size_t pending = 0;
+            bool eof = false;
+
+            while (true) {
+                bool blocked = false;
+                for (int pass = 0; pass < budget && !blocked; ++pass) {
+                    bool moved = false;
+                    if (!eof && pending < capacity) {
+                        ssize_t n = ::splice(fds.in, nullptr, fds.pipe[1], nullptr, capacity - pending, flags);
+                        if (n > 0) {
+                            pending += n;
+                            moved = true;
+                        } else if (n == 0) {
+                            eof = true;
+                        } else if (errno != EAGAIN) {
+                            co_return splice_error(total, pending);
+                        }
+                    }
+                    if (pending) {
+                        ssize_t n = ::splice(fds.pipe[0], nullptr, fds.out, nullptr, pending, flags);
+                        if (n > 0) {
+                            pending -= n;
+                            total += n;
+                            moved = true;
+                        } else if (n == 0) {
+                            // the pipe holds pending bytes, a socket that takes none of them is gone
+                            co_return error_code{UV_EPIPE};
+                        } else if (errno != EAGAIN) {
+                            co_return splice_error(total, pending);
+                        }
+                    }
+                    if (eof && !pending) {
+                        ::shutdown(fds.out, SHUT_WR);
+                        co_return total;
+                    }
+                    blocked = !moved;
+                }
+
+                // bytes stuck in the pipe stop reading until the receiver drains, that is the backpressure
+                auto& waiter = pending ? writable : readable;
+                if (auto err = waiter.start(pending ? UV_WRITABLE : UV_READABLE)) {
+                    co_return err;
+                }
+                int events = co_await waiter;
+                waiter.stop();
+                if (events < 0) {
+                    // libuv reports any socket error as UV_EBADF, the socket still holds the real one
+                    int err = 0;
+                    socklen_t size = sizeof(err);
+                    if (::getsockopt(pending ? fds.out : fds.in, SOL_SOCKET, SO_ERROR, &err, &size) == 0 && err) {
+                        co_return error_code{uv_translate_sys_error(err)};
+                    }
+                    co_return error_code{events};
+                }
+            }
+        }
+    }
+#endif
+
+    // relays from until it reaches end of stream, then half closes to. Returns the bytes moved.
+    // Neither socket may have an active reader of its own meanwhile
+    inline task<uint64_t, error_code> pipe_through(tcp& from, tcp& to)
+    {
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+        {
+            auto spliced = co_await detail::splice_relay(from.fileno(), to.fileno());
+            if (spliced || spliced.error() != UV_EINVAL) {
+                co_return std::move(spliced);
+            }
+        }
+#endif
+        uint64_t total = 0;
+        auto reader = from.read();
+        while (co_await reader) {
+            auto size = reader.size();
+            if (auto err = co_await to.write(reader.take())) {
+                co_return err;
+            }
+            total += size;
+        }
+        if (auto err = reader.error(); err && err != UV_EOF) {
+            co_return err;
+        }
+        to.shutdown();
+        co_return total;
+    }
+
+    namespace detail
+    {
+        inline task<> relay_half(tcp& from, tcp& to, uint64_t& moved, error_code& failed, std::size_t& left, timer& wake)
+        {
+            auto relayed = co_await pipe_through(from, to);
+            if (relayed) {
+                moved = relayed.value();
+            } else if (!failed) {
+                failed = relayed.error();
+            }
+            if (--left == 0 || !relayed) {
+                wake.start(0);
+            }
+        }
+    }
+
+    // both directions at once, completes when each side has closed its half. The first error
+    // cancels the other direction and closes both sockets
+    inline task<std::pair<uint64_t, uint64_t>, error_code> proxy(tcp& a, tcp& b)
+    {
+        std::pair<uint64_t, uint64_t> moved{0, 0};
+        error_code failed{0};
+        std::size_t left = 2;
+        timer wake;
+        task_group relays;
+        relays.spawn(detail::relay_half(a, b, moved.first, failed, left, wake));
+        relays.spawn(detail::relay_half(b, a, moved.second, failed, left, wake));
+        co_await wake;
+        if (failed) {
+            relays.cancel();
+            a.close();
+            b.close();
+            co_return failed;
+        }
+        co_return moved;
+    }
+}
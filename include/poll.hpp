@@ -0,0 +1,98 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <coroutine>
+#include <memory>
+#include <error_code.hpp>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
+
+namespace couv
+{
+    // readiness of a socket libuv does not own, level triggered while started
+    class poll
+    {
+        struct poll_data : slab_allocated<poll_data> {
+            uv_poll_t poll_handle;
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+            bool ready{false};
+            bool open{false};
+            int status{0};
+            int events{0};
+        };
+
+        struct poll_deleter
+        {
+            void operator()(poll_data* data) const noexcept {
+                data->node.cancel();
+                if (!data->open) {
+                    delete data;
+                    return;
+                }
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->poll_handle), [](uv_handle_t* poll_handle) {
+                    delete static_cast<poll_data*>(poll_handle->data);
+                });
+            }
+        };
+
+        std::unique_ptr<poll_data, poll_deleter> data;
+
+    public:
+        poll(uv_os_sock_t socket) : 
+            data{new poll_data{}, poll_deleter{}}
+        {
+            data->status = uv_poll_init_socket(current_loop(), &data->poll_handle, socket);
+            data->open = data->status == 0;
+            data->poll_handle.data = data.get();
+        }
+
+        poll(poll&&) = default;
+        poll& operator=(poll&&) = default;
+
+        // events is a mask of UV_READABLE, UV_WRITABLE and UV_DISCONNECT
+        error_code start(int events) {
+            if (data->status < 0) {
+                return data->status;
+            }
+            return uv_poll_start(&data->poll_handle, events, [](uv_poll_t* poll_handle, int status, int events) {
+                auto data = static_cast<poll_data*>(poll_handle->data);
+                data->ready = true;
+                data->status = status;
+                data->events = events;
+                [[likely]] if (data->co_handle) {
+                    data->node.resume(poll_handle->loop, std::exchange(data->co_handle, nullptr));
+                }
+            });
+        }
+
+        error_code stop() {
+            if (!data->open) {
+                return data->status;
+            }
+            return uv_poll_stop(&data->poll_handle);
+        }
+
+        bool await_ready() { 
+            return data->ready; 
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            data->co_handle = h;
+        }
+        
+        // the ready events, or a negative error
+        int await_resume() { 
+            data->co_handle = nullptr;
+            data->ready = false;
+            return data->status < 0 ? data->status : data->events;
+        }
+    };
+}
@@ -0,0 +1,193 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <pipe.hpp>
+#include <expect.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
+#include <error_code.hpp>
+
+namespace couv
+{
+    // streams left unpiped are inherited from this process
+    struct process_options
+    {
+        bool in{false};
+        bool out{true};
+        bool err{false};
+        std::string cwd{};
+        std::vector<std::string> env{};  // NAME=value, empty inherits the environment
+    };
+
+    // a child process driven by the loop, no thread waits for it. args[0] is searched in PATH
+    class process
+    {
+        struct process_data : slab_allocated<process_data> {
+            uv_process_t process_handle;
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+            int64_t exit_status{0};
+            int term_signal{0};
+            bool exited{false};
+            bool orphaned{false};
+        };
+
+        static void close(process_data* data) noexcept
+        {
+            close_handle(reinterpret_cast<uv_handle_t*>(&data->process_handle), [](uv_handle_t* process_handle) {
+                delete static_cast<process_data*>(process_handle->data);
+            });
+        }
+
+        // a child still running keeps its handle until it exits, so it is always reaped
+        struct process_deleter
+        {
+            void operator()(process_data* data) const noexcept {
+                data->node.cancel();
+                if (data->exited) {
+                    close(data);
+                } else {
+                    data->orphaned = true;
+                }
+            }
+        };
+
+        std::unique_ptr<process_data, process_deleter> data;
+        std::optional<pipe> stdin_pipe;
+        std::optional<pipe> stdout_pipe;
+        std::optional<pipe> stderr_pipe;
+        error_code status{0};
+
+        class exit_awaiter
+        {
+            process_data& data;
+            error_code status;
+
+        public:
+            exit_awaiter(process_data& data, error_code status) noexcept : data{data}, status{status} {}
+
+            bool await_ready() const noexcept { return status || data.exited; }
+            void await_suspend(std::coroutine_handle<> h) noexcept { data.co_handle = h; }
+
+            // the exit status, term_signal() tells whether a signal ended it
+            expect<int64_t, error_code> await_resume() noexcept
+            {
+                if (status) {
+                    return {std::in_place, status};
+                }
+                return data.exit_status;
+            }
+        };
+
+        static uv_stdio_container_t container(std::optional<pipe>& stream, int fd, int direction)
+        {
+            uv_stdio_container_t c;
+            if (stream) {
+                c.flags = static_cast<uv_stdio_flags>(UV_CREATE_PIPE | direction);
+                c.data.stream = reinterpret_cast<uv_stream_t*>(stream->handle.get());
+            } else {
+                c.flags = UV_INHERIT_FD;
+                c.data.fd = fd;
+            }
+            return c;
+        }
+
+    public:
+        process(std::vector<std::string> args, const process_options& options = {}) :
+            data{new process_data{}, process_deleter{}}
+        {
+            data->process_handle.data = data.get();
+            if (options.in) {
+                stdin_pipe.emplace();
+            }
+            if (options.out) {
+                stdout_pipe.emplace();
+            }
+            if (options.err) {
+                stderr_pipe.emplace();
+            }
+            uv_stdio_container_t stdio[3] = {
+                container(stdin_pipe, 0, UV_READABLE_PIPE),
+                container(stdout_pipe, 1, UV_WRITABLE_PIPE),
+                container(stderr_pipe, 2, UV_WRITABLE_PIPE)
+            };
+
+            std::vector<char*> argv;
+            for (auto& a : args) {
+                argv.push_back(a.data());
+            }
+            argv.push_back(nullptr);
+            std::vector<std::string> env{options.env};
+            std::vector<char*> envp;
+            for (auto& e : env) {
+                envp.push_back(e.data());
+            }
+            envp.push_back(nullptr);
+
+            uv_process_options_t spawn_options{};
+            spawn_options.file = argv[0] ? argv[0] : "";
+            spawn_options.args = argv.data();
+            spawn_options.env = options.env.empty() ? nullptr : envp.data();
+            spawn_options.cwd = options.cwd.empty() ? nullptr : options.cwd.c_str();
+            spawn_options.stdio = stdio;
+            spawn_options.stdio_count = 3;
+            spawn_options.exit_cb = [](uv_process_t* process_handle, int64_t exit_status, int term_signal) {
+                auto data = static_cast<process_data*>(process_handle->data);
+                data->exit_status = exit_status;
+                data->term_signal = term_signal;
+                data->exited = true;
+                if (data->orphaned) {
+                    close(data);
+                    return;
+                }
+                if (data->co_handle) {
+                    data->node.resume(process_handle->loop, std::exchange(data->co_handle, nullptr));
+                }
+            };
+
+            status = uv_spawn(current_loop(), &data->process_handle, &spawn_options);
+            if (status) {
+                // the handle is closed even when spawning failed
+                data->exited = true;
+            }
+        }
+
+        process(process&&) = default;
+        process& operator=(process&&) = default;
+
+        // why spawning failed, UV_ENOENT when args[0] was not found
+        error_code error() const noexcept { return status; }
+
+        int pid() const noexcept { return status ? 0 : data->process_handle.pid; }
+
+        // the piped streams, present when requested in process_options
+        pipe& in() noexcept { return *stdin_pipe; }
+        pipe& out() noexcept { return *stdout_pipe; }
+        pipe& err() noexcept { return *stderr_pipe; }
+
+        error_code kill(int signum) noexcept
+        {
+            if (status || data->exited) {
+                return UV_ESRCH;
+            }
+            return uv_process_kill(&data->process_handle, signum);
+        }
+
+        int term_signal() const noexcept { return data->term_signal; }
+
+        exit_awaiter exit() noexcept { return {*data, status}; }
+    };
+}
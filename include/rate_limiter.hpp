@@ -0,0 +1,313 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
+
+namespace couv
+{
+    namespace detail
+    {
+        class deadline_queue;
+
+        // pairing heap node inside the parked awaiter, prev is the parent for a first child
+        struct deadline_node
+        {
+            uint64_t deadline{0};
+            deadline_node* child{nullptr};
+            deadline_node* sibling{nullptr};
+            deadline_node* prev{nullptr};
+            deadline_queue* queue{nullptr};
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+        };
+
+        // one timer per loop for every parked waiter, armed for the earliest deadline. It is
+        // closed once the heap runs empty so it never keeps the loop from closing
+        class deadline_queue : public slab_allocated<deadline_queue>
+        {
+            uv_timer_t timer_handle;
+            deadline_node* root{nullptr};
+            deadline_queue* next;
+            bool expiring{false};
+
+            static deadline_queue*& registry() noexcept
+            {
+                static thread_local deadline_queue* head = nullptr;
+                return head;
+            }
+
+            deadline_queue(uv_loop_t* loop) noexcept : next{std::exchange(registry(), this)}
+            {
+                uv_timer_init(loop, &timer_handle);
+                timer_handle.data = this;
+            }
+
+            static deadline_node* meld(deadline_node* a, deadline_node* b) noexcept
+            {
+                if (!a || !b) {
+                    return a ? a : b;
+                }
+                if (b->deadline < a->deadline) {
+                    std::swap(a, b);
+                }
+                b->sibling = a->child;
+                if (a->child) {
+                    a->child->prev = b;
+                }
+                b->prev = a;
+                a->child = b;
+                return a;
+            }
+
+            // the two pass merge that gives the heap its amortised O(log n) pop
+            static deadline_node* merge_pairs(deadline_node* first) noexcept
+            {
+                deadline_node* pairs = nullptr;
+                while (first) {
+                    auto a = first;
+                    auto b = a->sibling;
+                    first = b ? b->sibling : nullptr;
+                    a->sibling = a->prev = nullptr;
+                    if (b) {
+                        b->sibling = b->prev = nullptr;
+                    }
+                    auto m = meld(a, b);
+                    m->sibling = pairs;
+                    pairs = m;
+                }
+                deadline_node* merged = nullptr;
+                while (pairs) {
+                    auto m = std::exchange(pairs, pairs->sibling);
+                    m->sibling = nullptr;
+                    merged = meld(merged, m);
+                }
+                return merged;
+            }
+
+            deadline_node* pop() noexcept
+            {
+                auto top = root;
+                root = merge_pairs(top->child);
+                if (root) {
+                    root->prev = nullptr;
+                }
+                top->child = nullptr;
+                top->queue = nullptr;
+                return top;
+            }
+
+            void arm() noexcept
+            {
+                if (!root) {
+                    close();
+                    return;
+                }
+                uint64_t now = uv_hrtime();
+                uint64_t delay = root->deadline > now ? (root->deadline - now + 999999) / 1000000 : 0;
+                uv_timer_start(&timer_handle, [](uv_timer_t* timer_handle) {
+                    static_cast<deadline_queue*>(timer_handle->data)->expire();
+                }, delay, 0);
+            }
+
+            void expire() noexcept
+            {
+                // waiters resumed here may park again or leave, the timer is rearmed once at the end
+                uint64_t now = uv_hrtime();
+                expiring = true;
+                while (root && root->deadline <= now) {
+                    auto due = pop();
+                    due->node.resume(timer_handle.loop, std::exchange(due->co_handle, nullptr));
+                }
+                expiring = false;
+                arm();
+            }
+
+            void close() noexcept
+            {
+                for (auto p = &registry(); *p; p = &(*p)->next) {
+                    if (*p == this) {
+                        *p = next;
+                        break;
+                    }
+                }
+                close_handle(reinterpret_cast<uv_handle_t*>(&timer_handle), [](uv_handle_t* timer_handle) {
+                    delete static_cast<deadline_queue*>(timer_handle->data);
+                });
+            }
+
+        public:
+            static deadline_queue& on(uv_loop_t* loop)
+            {
+                for (auto q = registry(); q; q = q->next) {
+                    if (q->timer_handle.loop == loop) {
+                        return *q;
+                    }
+                }
+                return *new deadline_queue{loop};
+            }
+
+            void push(deadline_node* n) noexcept
+            {
+                n->queue = this;
+                root = meld(root, n);
+                if (root == n && !expiring) {
+                    arm();
+                }
+            }
+
+            void erase(deadline_node* n) noexcept
+            {
+                if (n == root) {
+                    pop();
+                    if (!expiring) {
+                        arm();
+                    }
+                    return;
+                }
+                n->queue = nullptr;
+                (n->prev->child == n ? n->prev->child : n->prev->sibling) = n->sibling;
+                if (n->sibling) {
+                    n->sibling->prev = n->prev;
+                }
+                n->sibling = n->prev = nullptr;
+                if (auto children = merge_pairs(std::exchange(n->child, nullptr))) {
+                    children->prev = nullptr;
+                    root = meld(root, children);
+                }
+            }
+        };
+    }
+
+    // classic bucket, refills at rate tokens per second up to burst. Requests past the tokens at
+    // hand are reserved against future refills, so waiters are served in arrival order
+    class token_bucket
+    {
+        double rate;
+        double burst;
+        double tokens;
+        uint64_t last{0};
+
+        void refill(uint64_t now) noexcept
+        {
+            if (last) {
+                tokens = std::min(burst, tokens + (now - last) * rate / 1e9);
+            }
+            last = now;
+        }
+
+    public:
+        token_bucket(double rate, double burst) noexcept : rate{rate}, burst{burst}, tokens{burst} {}
+
+        // when n tokens are available, already taken
+        uint64_t reserve(uint64_t now, std::size_t n) noexcept
+        {
+            refill(now);
+            tokens -= n;
+            return tokens >= 0 ? now : now + static_cast<uint64_t>(-tokens / rate * 1e9);
+        }
+
+        bool try_take(uint64_t now, std::size_t n) noexcept
+        {
+            refill(now);
+            if (tokens < n) {
+                return false;
+            }
+            tokens -= n;
+            return true;
+        }
+    };
+
+    // generic cell rate algorithm, the same limit kept as a single theoretical arrival time
+    class gcra
+    {
+        uint64_t interval;
+        uint64_t tolerance;
+        uint64_t tat{0};
+
+    public:
+        gcra(double rate, double burst) noexcept
+            : interval{static_cast<uint64_t>(1e9 / rate)}, tolerance{static_cast<uint64_t>(burst * 1e9 / rate)} {}
+
+        uint64_t reserve(uint64_t now, std::size_t n) noexcept
+        {
+            tat = std::max(tat, now) + n * interval;
+            return std::max(tat - std::min(tat, tolerance), now);
+        }
+
+        bool try_take(uint64_t now, std::size_t n) noexcept
+        {
+            uint64_t next = std::max(tat, now) + n * interval;
+            if (next > now + tolerance) {
+                return false;
+            }
+            tat = next;
+            return true;
+        }
+    };
+
+    // co_await acquire(n) completes inline while the limit allows, otherwise the coroutine is
+    // parked on the loop's shared deadline timer. A limiter holds no handle of its own
+    template <typename Policy>
+    class basic_rate_limiter
+    {
+        Policy policy;
+
+        class acquire_awaiter : detail::deadline_node
+        {
+            basic_rate_limiter& limiter;
+            std::size_t n;
+
+        public:
+            acquire_awaiter(basic_rate_limiter& limiter, std::size_t n) noexcept : limiter{limiter}, n{n} {}
+
+            // the reservation stays taken when a parked coroutine is destroyed
+            ~acquire_awaiter()
+            {
+                if (queue) {
+                    queue->erase(this);
+                }
+            }
+
+            bool await_ready() noexcept
+            {
+                uint64_t now = uv_hrtime();
+                deadline = limiter.policy.reserve(now, n);
+                return deadline <= now;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                co_handle = h;
+                detail::deadline_queue::on(current_loop()).push(this);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        // rate per second, burst is how many may pass at once after an idle period
+        basic_rate_limiter(double rate, double burst = 1) noexcept : policy{rate, burst} {}
+
+        bool try_acquire(std::size_t n = 1) noexcept
+        {
+            return policy.try_take(uv_hrtime(), n);
+        }
+
+        acquire_awaiter acquire(std::size_t n = 1) noexcept { return {*this, n}; }
+    };
+
+    using rate_limiter = basic_rate_limiter<token_bucket>;
+    using gcra_limiter = basic_rate_limiter<gcra>;
+}
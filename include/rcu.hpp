@@ -0,0 +1,260 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <uv.h> // libuv
+#include <scheduler.hpp>
+
+namespace couv
+{
+    namespace detail
+    {
+        class rcu_domain;
+
+        // one per loop reading rcu values: the versions it read since its last quiescent point
+        class rcu_participant final : public quiescent_hook
+        {
+            friend class rcu_domain;
+
+            rcu_domain& domain;
+            event_loop& loop;
+            std::vector<std::pair<uint64_t, const void*>> cache;
+            uint64_t last;
+            std::atomic<uint64_t> seen;
+
+        public:
+            rcu_participant(rcu_domain& domain, event_loop& loop, uint64_t epoch) noexcept :
+                quiescent_hook{&domain}, domain{domain}, loop{loop}, last{epoch}, seen{epoch} {}
+
+            const void* find(uint64_t id) const noexcept
+            {
+                for (auto& [owner, version] : cache) {
+                    if (owner == id) {
+                        return version;
+                    }
+                }
+                return nullptr;
+            }
+
+            void insert(uint64_t id, const void* version) { cache.emplace_back(id, version); }
+
+            void quiescent() noexcept override;
+            void loop_closing() noexcept override;
+        };
+
+        // quiescent state based reclamation shared by every rcu. Each publish starts a new epoch,
+        // the version it replaced is freed once every participating loop has passed a quiescent
+        // point in that epoch or later. Reads only touch loop local state
+        class rcu_domain
+        {
+            struct retired
+            {
+                const void* version;
+                void (*destroy)(const void*);
+                uint64_t epoch;
+            };
+
+            std::mutex lock;
+            std::vector<rcu_participant*> participants;
+            std::vector<retired> retired_versions;
+            std::atomic<uint64_t> epoch{1};
+            std::atomic<std::size_t> backlog{0};
+            std::atomic<uint64_t> next_id{1};
+
+            friend class rcu_participant;
+
+            // moves what no participant can still hold into freed
+            void collect(std::vector<retired>& freed)
+            {
+                uint64_t oldest = UINT64_MAX;
+                for (auto p : participants) {
+                    oldest = std::min(oldest, p->seen.load(std::memory_order_acquire));
+                }
+                auto keep = std::partition(retired_versions.begin(), retired_versions.end(),
+                    [&](const retired& r) { return r.epoch > oldest; });
+                freed.assign(keep, retired_versions.end());
+                retired_versions.erase(keep, retired_versions.end());
+                backlog.store(retired_versions.size(), std::memory_order_relaxed);
+            }
+
+            static void destroy(std::vector<retired>& freed) noexcept
+            {
+                for (auto& r : freed) {
+                    r.destroy(r.version);
+                }
+            }
+
+            void try_reclaim()
+            {
+                std::vector<retired> freed;
+                if (!lock.try_lock()) {
+                    return;
+                }
+                collect(freed);
+                lock.unlock();
+                destroy(freed);
+            }
+
+            void leave(rcu_participant* p)
+            {
+                std::vector<retired> freed;
+                {
+                    std::lock_guard guard{lock};
+                    participants.erase(std::find(participants.begin(), participants.end(), p));
+                    collect(freed);
+                }
+                destroy(freed);
+            }
+
+        public:
+            static rcu_domain& instance()
+            {
+                static rcu_domain domain;
+                return domain;
+            }
+
+            uint64_t new_id() noexcept { return next_id.fetch_add(1, std::memory_order_relaxed); }
+
+            // the calling loop's participant, joining on its first read
+            rcu_participant& participant()
+            {
+                auto& loop = event_loop::current();
+                [[likely]] if (auto hook = loop.find_hook(this)) {
+                    return *static_cast<rcu_participant*>(hook);
+                }
+                rcu_participant* p;
+                {
+                    std::lock_guard guard{lock};
+                    p = new rcu_participant{*this, loop, epoch.load(std::memory_order_acquire)};
+                    participants.push_back(p);
+                }
+                loop.add_hook(p);
+                return *p;
+            }
+
+            // version was replaced before this call, loops are woken so idle ones pass a
+            // quiescent point too
+            void retire(const void* version, void (*destroy_version)(const void*))
+            {
+                std::vector<retired> freed;
+                {
+                    std::lock_guard guard{lock};
+                    uint64_t retired_at = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+                    retired_versions.push_back({version, destroy_version, retired_at});
+                    collect(freed);
+                    for (auto p : participants) {
+                        p->loop.wake();
+                    }
+                }
+                destroy(freed);
+            }
+
+            // versions retired but not freed yet
+            std::size_t pending() const noexcept { return backlog.load(std::memory_order_relaxed); }
+        };
+
+        inline void rcu_participant::quiescent() noexcept
+        {
+            uint64_t current = domain.epoch.load(std::memory_order_acquire);
+            if (current != last) {
+                cache.clear();
+                last = current;
+                seen.store(current, std::memory_order_release);
+            }
+            if (domain.backlog.load(std::memory_order_relaxed)) {
+                domain.try_reclaim();
+            }
+        }
+
+        inline void rcu_participant::loop_closing() noexcept
+        {
+            domain.leave(this);
+            delete this;
+        }
+    }
+
+    // read mostly value shared between loops. read() gives the loop the same version until its
+    // next quiescent point, which is between callbacks, so a reference must not be kept across
+    // a co_await. Writers publish a new version, the old one is freed once every loop moved on
+    template <typename T>
+    class rcu
+    {
+        std::atomic<const T*> current;
+        std::mutex writer;
+        uint64_t id;
+
+        static void destroy(const void* version)
+        {
+            delete static_cast<const T*>(version);
+        }
+
+        void swap(std::unique_ptr<const T> next)
+        {
+            auto old = current.exchange(next.release(), std::memory_order_acq_rel);
+            detail::rcu_domain::instance().retire(old, destroy);
+        }
+
+    public:
+        template <typename... Args>
+        explicit rcu(Args&&... args) :
+            current{new T(std::forward<Args>(args)...)},
+            id{detail::rcu_domain::instance().new_id()}
+        {
+        }
+
+        rcu(const rcu&) = delete;
+        rcu& operator=(const rcu&) = delete;
+
+        ~rcu()
+        {
+            detail::rcu_domain::instance().retire(current.load(std::memory_order_acquire), destroy);
+        }
+
+        // loop threads only. After the first read of a version no atomic is touched
+        const T& read()
+        {
+            auto& p = detail::rcu_domain::instance().participant();
+            [[likely]] if (auto cached = p.find(id)) {
+                return *static_cast<const T*>(cached);
+            }
+            auto version = current.load(std::memory_order_acquire);
+            p.insert(id, version);
+            return *version;
+        }
+
+        // versions retired by any rcu and not freed yet, 0 once every loop moved on
+        static std::size_t pending() noexcept
+        {
+            return detail::rcu_domain::instance().pending();
+        }
+
+        // any thread
+        void publish(T value)
+        {
+            std::lock_guard guard{writer};
+            swap(std::make_unique<const T>(std::move(value)));
+        }
+
+        // read, copy, update: fn changes a copy of the latest version, which is then published.
+        // Updates are serialised so none is lost
+        template <typename F>
+        void update(F fn)
+        {
+            std::lock_guard guard{writer};
+            auto next = std::make_unique<T>(*current.load(std::memory_order_acquire));
+            fn(*next);
+            swap(std::move(next));
+        }
+    };
+}
@@ -0,0 +1,168 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+#include <slab.hpp>
+
+// receive buffer policies for basic_reader. A buffer is claimed right before the socket is read,
+// libuv only asks once it is readable, and released when the consumer awaits the next chunk
+namespace couv
+{
+    // blocks shared by all readers of the thread, an idle connection holds none
+    class shared_buffer
+    {
+        static constexpr std::size_t block_size = 64 * 1024;
+        static constexpr std::size_t max_free = 16;
+
+        std::unique_ptr<char[]> block;
+
+        static std::vector<std::unique_ptr<char[]>>& pool() noexcept
+        {
+            static thread_local std::vector<std::unique_ptr<char[]>> free;
+            return free;
+        }
+
+    public:
+        shared_buffer() = default;
+        shared_buffer(shared_buffer&&) = default;
+
+        ~shared_buffer()
+        {
+            release();
+        }
+
+        std::span<char> claim(std::size_t)
+        {
+            if (!block) {
+                auto& free = pool();
+                if (free.empty()) {
+                    block.reset(new char[block_size]);
+                } else {
+                    block = std::move(free.back());
+                    free.pop_back();
+                }
+            }
+            return {block.get(), block_size};
+        }
+
+        std::span<char> held() const noexcept
+        {
+            return block ? std::span<char>{block.get(), block_size} : std::span<char>{};
+        }
+
+        void release() noexcept
+        {
+            if (block && pool().size() < max_free) {
+                pool().push_back(std::move(block));
+            }
+            block.reset();
+        }
+
+        // hands the held block over, it returns to the pool once the last owner lets go
+        std::shared_ptr<const char> detach()
+        {
+            return {block.release(), [](const char* p) {
+                std::unique_ptr<char[]> released{const_cast<char*>(p)};
+                if (pool().size() < max_free) {
+                    pool().push_back(std::move(released));
+                }
+            }};
+        }
+    };
+
+    // N bytes inside the reader itself, no allocation but always resident
+    template <std::size_t N>
+    class inline_buffer
+    {
+        std::array<char, N> storage;
+        bool claimed{false};
+
+    public:
+        std::span<char> claim(std::size_t)
+        {
+            claimed = true;
+            return storage;
+        }
+
+        std::span<char> held() noexcept
+        {
+            return claimed ? std::span<char>{storage} : std::span<char>{};
+        }
+
+        void release() noexcept
+        {
+            claimed = false;
+        }
+    };
+
+    // N byte blocks from the thread's slab, counted by for_each_slab
+    template <std::size_t N = 16 * 1024>
+    class slab_buffer
+    {
+        struct block : slab_allocated<block>
+        {
+            char bytes[N];
+        };
+
+        std::unique_ptr<block> claimed;
+
+    public:
+        std::span<char> claim(std::size_t)
+        {
+            if (!claimed) {
+                claimed.reset(new block);
+            }
+            return claimed->bytes;
+        }
+
+        std::span<char> held() const noexcept
+        {
+            return claimed ? std::span<char>{claimed->bytes} : std::span<char>{};
+        }
+
+        void release() noexcept
+        {
+            claimed.reset();
+        }
+
+        std::shared_ptr<const char> detach()
+        {
+            std::shared_ptr<block> owner{std::move(claimed)};
+            return {owner, owner->bytes};
+        }
+    };
+
+    // storage owned by the caller, which must outlive the reader
+    class user_buffer
+    {
+        std::span<char> storage;
+        bool claimed{false};
+
+    public:
+        user_buffer(std::span<char> storage) noexcept : storage{storage} {}
+
+        std::span<char> claim(std::size_t)
+        {
+            claimed = true;
+            return storage;
+        }
+
+        std::span<char> held() const noexcept
+        {
+            return claimed ? storage : std::span<char>{};
+        }
+
+        void release() noexcept
+        {
+            claimed = false;
+        }
+    };
+}
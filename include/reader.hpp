@@ -8,29 +8,49 @@
 #include <coroutine>
 #include <iostream>
 #include <memory>
+#include <span>
+#include <string>
 #include <error_code.hpp>
+#include <read_buffer.hpp>
+#include <buffer_chain.hpp>
 
 #include <uv.h> // libuv
+#include <scheduler.hpp>
 
 namespace couv
 {
     class tcp;
-    class reader
+    class pipe;
+
+    template <typename BufferPolicy>
+    class basic_reader
     {
         std::shared_ptr<uv_stream_t> stream;
-        std::string buf;
+        BufferPolicy policy;
         ssize_t nread{0};
+        std::size_t last{0};
         std::coroutine_handle<> co_handle;
+        ready_node node;
+        bool paused{false};
+
+        void pause() noexcept
+        {
+            uv_read_stop(stream.get());
+            paused = true;
+        }
 
     public:
-        reader(const tcp&);
+        basic_reader(const tcp&, BufferPolicy policy = {});
+        basic_reader(const pipe&, BufferPolicy policy = {});
 
-        reader(const reader&) = delete;
-        reader(reader&& r) : 
+        basic_reader(const basic_reader&) = delete;
+        basic_reader(basic_reader&& r) : 
             stream{std::move(r.stream)}, 
-            buf{std::move(r.buf)},
+            policy{std::move(r.policy)},
             nread{std::move(r.nread)},
-            co_handle{std::move(r.co_handle)}
+            last{r.last},
+            co_handle{std::move(r.co_handle)},
+            paused{r.paused}
         {
             stream->data = this;
         }
@@ -44,36 +64,105 @@ namespace couv
         {
             return uv_read_start(stream.get(),
                 [](uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-                    auto self = static_cast<reader*>(handle->data);
-                    self->buf.resize(suggested_size);
-                    *buf = uv_buf_init(self->buf.data(), suggested_size);
+                    auto self = static_cast<basic_reader*>(handle->data);
+                    // the last chunk is still in use, an empty buffer makes libuv report UV_ENOBUFS
+                    if (!self->policy.held().empty()) {
+                        *buf = uv_buf_init(nullptr, 0);
+                        return;
+                    }
+                    auto claimed = self->policy.claim(suggested_size);
+                    // keep one byte to null terminate the chunk
+                    *buf = uv_buf_init(claimed.data(), claimed.empty() ? 0 : claimed.size() - 1);
                 },
                 [](uv_stream_t* req, ssize_t nread, const uv_buf_t* buf) {
-                    auto self = static_cast<reader*>(req->data);
+                    auto self = static_cast<basic_reader*>(req->data);
+                    if (nread == UV_ENOBUFS && buf->len == 0 && !self->policy.held().empty()) {
+                        self->pause();
+                        return;
+                    }
+                    if (nread <= 0) {
+                        self->policy.release();
+                        if (nread == 0) {
+                            return;
+                        }
+                    } else {
+                        buf->base[nread] = '\0';
+                    }
                     self->nread = nread;
-                    [[likely]] if (self->co_handle)
+                    [[likely]] if (self->co_handle && !ready_node::deferred_on(req->loop)) {
                         self->co_handle();
+                        return;
+                    }
+                    // nobody is consuming yet, hold off until this chunk is
+                    self->pause();
+                    if (self->co_handle) {
+                        self->node.resume(req->loop, std::exchange(self->co_handle, nullptr));
+                    }
                 });
         }
         
-        bool await_ready() const { return nread > 0; }
+        // awaiting the next chunk gives the buffer of the last one back
+        bool await_ready() 
+        { 
+            if (nread != 0) {
+                return true;
+            }
+            policy.release();
+            if (paused) {
+                paused = false;
+                start();
+            }
+            return false;
+        }
+
         void await_suspend(std::coroutine_handle<> h) { co_handle = h; } 
+
         const char* await_resume() 
         {
             const char* out = nullptr;
+            last = 0;
             if (nread > 0) {
-                out = buf.c_str();
+                out = policy.held().data();
+                last = nread;
                 nread = 0;
             } 
             co_handle = nullptr; 
             return out;
         }
 
-        ~reader()
+        // the last chunk as a chain slice, sharing the receive buffer when the policy can give it away
+        buffer_chain take()
+        {
+            buffer_chain chain;
+            auto held = policy.held();
+            if (last == 0 || held.empty()) {
+                return chain;
+            }
+            if constexpr (requires { policy.detach(); }) {
+                chain.append(policy.detach(), held.data(), last);
+            } else {
+                chain.append(std::string{held.data(), last});
+            }
+            return chain;
+        }
+
+        // why the last co_await returned null, UV_EOF or the read error
+        error_code error() const noexcept { return nread < 0 ? static_cast<int>(nread) : 0; }
+
+        // length of the chunk returned by the last co_await
+        std::size_t size() const noexcept { return last; }
+
+        // receive buffer of the last chunk, free to reuse once that chunk has been consumed
+        std::span<char> buffer() noexcept { return policy.held(); }
+
+        ~basic_reader()
         {
             if (stream) {
+                node.cancel();
                 uv_read_stop(stream.get());
             }
         }
-    };   
-}
\ No newline at end of file
+    };
+
+    using reader = basic_reader<shared_buffer>;
+}
@@ -0,0 +1,430 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <tcp.hpp>
+#include <task.hpp>
+#include <expect.hpp>
+#include <error_code.hpp>
+#include <buffer_chain.hpp>
+
+namespace couv
+{
+    struct redis_reply
+    {
+        enum class kind : char
+        {
+            simple = '+',
+            error = '-',
+            integer = ':',
+            bulk = '$',
+            array = '*',
+            null = '_'
+        };
+
+        kind type{kind::null};
+        std::string_view str;  // simple, error and bulk, a view into the receive buffer
+        int64_t integer{0};
+        std::vector<redis_reply> elements;
+        std::shared_ptr<const void> owner;  // keeps str of this reply and its elements alive
+
+        bool is_error() const noexcept { return type == kind::error; }
+        bool is_null() const noexcept { return type == kind::null; }
+    };
+
+    namespace resp
+    {
+        inline bool parse_line(std::string_view data, std::size_t& pos, std::string_view& line) noexcept
+        {
+            auto end = data.find("\r\n", pos);
+            if (end == std::string_view::npos) {
+                return false;
+            }
+            line = data.substr(pos, end - pos);
+            pos = end + 2;
+            return true;
+        }
+
+        inline bool parse_integer(std::string_view line, int64_t& value) noexcept
+        {
+            auto [end, ec] = std::from_chars(line.data(), line.data() + line.size(), value);
+            return ec == std::errc{} && end == line.data() + line.size();
+        }
+
+        // one value starting at pos, which moves past it. 1 when complete, 0 while more bytes are
+        // needed and UV_EPROTO for malformed input
+        inline int parse(std::string_view data, std::size_t& pos, redis_reply& out)
+        {
+            std::size_t at = pos;
+            std::string_view line;
+            if (at >= data.size()) {
+                return 0;
+            }
+            char type = data[at++];
+            if (!parse_line(data, at, line)) {
+                return 0;
+            }
+            switch (type) {
+            case '+':
+            case '-':
+                out.type = static_cast<redis_reply::kind>(type);
+                out.str = line;
+                break;
+            case ':':
+                out.type = redis_reply::kind::integer;
+                if (!parse_integer(line, out.integer)) {
+                    return UV_EPROTO;
+                }
+                break;
+            case '$': {
+                int64_t size;
+                if (!parse_integer(line, size)) {
+                    return UV_EPROTO;
+                }
+                if (size < 0) {
+                    out.type = redis_reply::kind::null;
+                    break;
+                }
+                if (data.size() - at < static_cast<std::size_t>(size) + 2) {
+                    return 0;
+                }
+                out.type = redis_reply::kind::bulk;
+                out.str = data.substr(at, size);
+                at += size + 2;
+                break;
+            }
+            case '*': {
+                int64_t count;
+                if (!parse_integer(line, count)) {
+                    return UV_EPROTO;
+                }
+                if (count < 0) {
+                    out.type = redis_reply::kind::null;
+                    break;
+                }
+                out.type = redis_reply::kind::array;
+                out.elements.resize(count);
+                for (auto& element : out.elements) {
+                    if (int ret = parse(data, at, element); ret <= 0) {
+                        return ret;
+                    }
+                }
+                break;
+            }
+            default:
+                return UV_EPROTO;
+            }
+            pos = at;
+            return 1;
+        }
+
+        inline void append_header(std::string& out, char type, std::size_t size)
+        {
+            char digits[24];
+            auto end = std::to_chars(digits, digits + sizeof(digits), size).ptr;
+            out += type;
+            out.append(digits, end);
+            out += "\r\n";
+        }
+
+        inline void append_bulk(std::string& out, std::string_view arg)
+        {
+            append_header(out, '$', arg.size());
+            out.append(arg);
+            out += "\r\n";
+        }
+    }
+
+    namespace detail
+    {
+        // replies are parsed where they were received, a block is only replaced once full and
+        // only the unparsed tail is copied over
+        struct reply_segment
+        {
+            static constexpr std::size_t block_size = 64 * 1024;
+            static constexpr std::size_t min_read = 4096;
+
+            std::shared_ptr<char[]> block;
+            std::size_t size{0};
+            std::size_t begin{0};
+            std::size_t end{0};
+
+            void reserve()
+            {
+                std::size_t unparsed = end - begin;
+                if (!unparsed && block && block.use_count() == 1) {
+                    begin = end = 0;
+                }
+                if (size - end >= min_read) {
+                    return;
+                }
+                std::size_t grown = std::max(block_size, 2 * unparsed + min_read);
+                std::shared_ptr<char[]> next{new char[grown]};
+                if (unparsed) {
+                    std::memcpy(next.get(), block.get() + begin, unparsed);
+                }
+                block = std::move(next);
+                size = grown;
+                begin = 0;
+                end = unparsed;
+            }
+
+            std::string_view data() const noexcept { return {block.get(), end}; }
+        };
+
+        // receive buffer policy over the free space of the current segment
+        class reply_buffer
+        {
+            reply_segment* segment;
+            std::span<char> claimed;
+
+        public:
+            reply_buffer(reply_segment& segment) noexcept : segment{&segment} {}
+
+            std::span<char> claim(std::size_t)
+            {
+                claimed = {segment->block.get() + segment->end, segment->size - segment->end};
+                return claimed;
+            }
+
+            std::span<char> held() const noexcept { return claimed; }
+
+            void release() noexcept { claimed = {}; }
+        };
+    }
+
+    // one connection shared by every task. Commands issued during a loop iteration are sent
+    // together in one gathered write from an idle handle, replies complete them in order
+    class redis
+    {
+    public:
+        class command;
+
+    private:
+        struct redis_data
+        {
+            tcp socket;
+            detail::reply_segment segment;
+            std::optional<basic_reader<detail::reply_buffer>> reader;
+            std::optional<task<void, error_code>> receiver;
+            uv_idle_t flusher;
+            std::string out;
+            buffer_chain chain;
+            std::deque<command*> pending;
+            error_code status{UV_ENOTCONN};
+            bool closed{false};
+        };
+
+        struct redis_deleter
+        {
+            void operator()(redis_data* data) const noexcept {
+                data->closed = true;
+                if (data->reader) {
+                    data->reader->stop();
+                }
+                // commands still awaited get no reply any more
+                fail_all(*data, UV_ECANCELED);
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->flusher), [](uv_handle_t* flusher) {
+                    delete static_cast<redis_data*>(flusher->data);
+                });
+            }
+        };
+
+        std::unique_ptr<redis_data, redis_deleter> data;
+
+        static void complete(command* c, expect<redis_reply, error_code> result)
+        {
+            c->slot = nullptr;
+            c->result = std::move(result);
+            c->done = true;
+            if (c->co_handle) {
+                c->node.resume(c->loop, std::exchange(c->co_handle, nullptr));
+            }
+        }
+
+        static void fail_all(redis_data& s, error_code err)
+        {
+            s.status = err;
+            while (!s.pending.empty()) {
+                auto c = s.pending.front();
+                s.pending.pop_front();
+                if (c) {
+                    complete(c, expect<redis_reply, error_code>{std::in_place, err});
+                }
+            }
+        }
+
+        static void flush(redis_data& s)
+        {
+            uv_idle_stop(&s.flusher);
+            if (!s.out.empty()) {
+                s.chain.append(std::move(s.out));
+                s.out.clear();
+            }
+            if (!s.chain.empty()) {
+                // a write failing later breaks the connection, the receiver then fails the commands
+                writer w{s.socket};
+                if (auto err = w.write(std::exchange(s.chain, {}))) {
+                    fail_all(s, err);
+                }
+            }
+        }
+
+        static task<void, error_code> receive(redis_data& s)
+        {
+            auto& reader = *s.reader;
+            while (!s.closed) {
+                s.segment.reserve();
+                auto chunk = co_await reader;
+                if (!chunk) {
+                    fail_all(s, reader.error());
+                    co_return s.status;
+                }
+                s.segment.end += reader.size();
+
+                auto received = s.segment.data();
+                while (!s.closed) {
+                    redis_reply reply;
+                    std::size_t pos = s.segment.begin;
+                    int ret = resp::parse(received, pos, reply);
+                    if (ret == 0) {
+                        break;
+                    }
+                    if (ret < 0 || s.pending.empty()) {
+                        fail_all(s, ret < 0 ? ret : UV_EPROTO);
+                        reader.stop();
+                        co_return s.status;
+                    }
+                    s.segment.begin = pos;
+                    reply.owner = s.segment.block;
+                    auto c = s.pending.front();
+                    s.pending.pop_front();
+                    if (c) {
+                        complete(c, std::move(reply));
+                    }
+                }
+            }
+            co_return error_code{0};
+        }
+
+        template <typename Arg>
+        void append_arg(Arg&& arg)
+        {
+            auto& s = *data;
+            if constexpr (std::is_integral_v<std::decay_t<Arg>>) {
+                resp::append_bulk(s.out, std::to_string(arg));
+            } else if constexpr (std::is_same_v<Arg, std::string>) {
+                // large values are sent from the caller's string instead of being copied
+                if (arg.size() < 1024) {
+                    resp::append_bulk(s.out, arg);
+                    return;
+                }
+                resp::append_header(s.out, '$', arg.size());
+                s.chain.append(std::move(s.out));
+                s.out.clear();
+                s.chain.append(std::move(arg));
+                s.out += "\r\n";
+            } else {
+                resp::append_bulk(s.out, std::string_view{arg});
+            }
+        }
+
+    public:
+        class command
+        {
+            command** slot{nullptr};
+            uv_loop_t* loop{nullptr};
+            std::coroutine_handle<> co_handle;
+            ready_node node;
+            expect<redis_reply, error_code> result;
+            bool done{false};
+
+            friend class redis;
+
+            command(error_code err) : result{std::in_place, err}, done{true} {}
+
+            command(redis_data& s) : loop{s.flusher.loop}
+            {
+                s.pending.push_back(this);
+                slot = &s.pending.back();
+            }
+
+        public:
+            command(const command&) = delete;
+            command& operator=(const command&) = delete;
+
+            // the reply of an abandoned command is read and dropped
+            ~command()
+            {
+                if (slot) {
+                    *slot = nullptr;
+                }
+            }
+
+            bool await_ready() const noexcept { return done; }
+            void await_suspend(std::coroutine_handle<> h) noexcept { co_handle = h; }
+
+            // an error reply is a value, the error code is for the connection failing
+            expect<redis_reply, error_code> await_resume() { return std::move(result); }
+        };
+
+        redis() : data{new redis_data{}, redis_deleter{}}
+        {
+            uv_idle_init(current_loop(), &data->flusher);
+            data->flusher.data = data.get();
+        }
+
+        task<void, error_code> connect(const char* ip, int port, const tcp_options& options = {})
+        {
+            auto& s = *data;
+            if (auto err = co_await s.socket.connect(ip, port, options)) {
+                co_return err;
+            }
+            s.segment.reserve();
+            s.reader.emplace(s.socket.read(detail::reply_buffer{s.segment}));
+            s.status = 0;
+            s.receiver.emplace(receive(s));
+            co_return error_code{0};
+        }
+
+        // args are strings, string views or integers. The command is queued at once, so commands
+        // issued in sequence are answered in that order even before they are awaited
+        template <typename... Args>
+        command cmd(Args&&... args)
+        {
+            auto& s = *data;
+            if (s.status) {
+                return command{s.status};
+            }
+            resp::append_header(s.out, '*', sizeof...(args));
+            (append_arg(std::forward<Args>(args)), ...);
+            if (!uv_is_active(reinterpret_cast<uv_handle_t*>(&s.flusher))) {
+                uv_idle_start(&s.flusher, [](uv_idle_t* flusher) {
+                    flush(*static_cast<redis_data*>(flusher->data));
+                });
+            }
+            return command{s};
+        }
+
+        // commands still waiting for their reply
+        std::size_t in_flight() const noexcept { return data->pending.size(); }
+    };
+}
@@ -0,0 +1,604 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <uv.h> // libuv
+#include <unistd.h>
+#include <loop.hpp>
+#include <tcp.hpp>
+#include <writer.hpp>
+#include <task.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
+#include <error_code.hpp>
+#include <buffer_chain.hpp>
+#include <buffered_reader.hpp>
+
+// calls multiplexed over one tcp connection. Every frame carries a 12 byte header:
+//
+//   u32 length | u32 stream | u8 type | u8 flags | u16 method    (big endian)
+//
+// A call is a stream opened by the client, both sides send data frames on it and flag the last
+// one with end. Each side may have window bytes in flight per stream, the receiver hands credit
+// back in window frames as the application reads
+namespace couv::rpc
+{
+    enum class frame_type : uint8_t
+    {
+        data = 0,
+        window = 1,
+        reset = 2
+    };
+
+    enum frame_flags : uint8_t
+    {
+        open = 1,
+        end = 2
+    };
+
+    constexpr std::size_t header_size = 12;
+    constexpr std::size_t max_frame = 16 * 1024;
+    constexpr int64_t initial_window = 256 * 1024;
+
+    struct frame_header
+    {
+        uint32_t length{0};
+        uint32_t stream{0};
+        frame_type type{frame_type::data};
+        uint8_t flags{0};
+        uint16_t method{0};
+
+        void encode(std::string& out) const
+        {
+            auto put = [&out](uint32_t value, int bytes) {
+                while (bytes--) {
+                    out += static_cast<char>(value >> (8 * bytes));
+                }
+            };
+            put(length, 4);
+            put(stream, 4);
+            put(static_cast<uint8_t>(type), 1);
+            put(flags, 1);
+            put(method, 2);
+        }
+
+        static frame_header decode(std::string_view in) noexcept
+        {
+            auto get = [&in](std::size_t at, int bytes) {
+                uint32_t value = 0;
+                while (bytes--) {
+                    value = value << 8 | static_cast<uint8_t>(in[at++]);
+                }
+                return value;
+            };
+            return {get(0, 4), get(4, 4), static_cast<frame_type>(get(8, 1)),
+                static_cast<uint8_t>(get(9, 1)), static_cast<uint16_t>(get(10, 2))};
+        }
+    };
+
+    class stream;
+    using handler = std::function<task<>(stream&)>;
+
+    namespace detail
+    {
+        struct channel;
+
+        struct stream_state : slab_allocated<stream_state>
+        {
+            channel* ch{nullptr};   // null once the channel is gone and a stream still holds this
+            uint32_t id{0};
+            uint16_t method{0};
+            std::deque<std::string> chunks;
+            bool ended{false};
+            bool sent_end{false};
+            bool opened{false};
+            error_code error{0};
+            int64_t send_window{initial_window};
+            int64_t consumed{0};
+            std::coroutine_handle<> reader;
+            std::coroutine_handle<> writer;
+            bool held{false};       // by a stream object
+
+            // resuming the reader can end the call and free this state, so both are taken first
+            void wake() noexcept
+            {
+                auto waiting_reader = std::exchange(reader, nullptr);
+                auto waiting_writer = std::exchange(writer, nullptr);
+                if (waiting_reader) {
+                    waiting_reader.resume();
+                }
+                if (waiting_writer) {
+                    waiting_writer.resume();
+                }
+            }
+        };
+
+        // one connection. Frames queued during a loop iteration go out together in one gathered
+        // write from an idle handle, large payloads as their own slice
+        struct channel
+        {
+            static constexpr std::size_t buffer_size = 2 * (header_size + max_frame);
+
+            tcp socket;
+            std::optional<buffered_reader> input;
+            uv_idle_t flusher;
+            std::string out;
+            buffer_chain chain;
+            std::unordered_map<uint32_t, std::unique_ptr<stream_state>> streams;
+            const std::unordered_map<uint16_t, handler>* handlers{nullptr};
+            uint32_t next_id{1};
+            error_code status{0};
+            bool closed{false};
+            task_group running;
+            std::optional<task<void, error_code>> receiver;
+
+            channel(tcp&& s, const std::unordered_map<uint16_t, handler>* handlers) :
+                socket{std::move(s)},
+                input{std::in_place, socket, buffer_size},
+                handlers{handlers}
+            {
+                uv_idle_init(current_loop(), &flusher);
+                flusher.data = this;
+            }
+
+            void send(const frame_header& header, std::string_view payload)
+            {
+                if (closed || status) {
+                    return;
+                }
+                header.encode(out);
+                out.append(payload);
+                schedule_flush();
+            }
+
+            void send(const frame_header& header, std::string&& payload)
+            {
+                if (payload.size() < 1024) {
+                    send(header, std::string_view{payload});
+                    return;
+                }
+                if (closed || status) {
+                    return;
+                }
+                header.encode(out);
+                chain.append(std::move(out));
+                out.clear();
+                chain.append(std::move(payload));
+                schedule_flush();
+            }
+
+            void schedule_flush()
+            {
+                if (!uv_is_active(reinterpret_cast<uv_handle_t*>(&flusher))) {
+                    uv_idle_start(&flusher, [](uv_idle_t* flusher) {
+                        static_cast<channel*>(flusher->data)->flush();
+                    });
+                }
+            }
+
+            void flush()
+            {
+                uv_idle_stop(&flusher);
+                if (!out.empty()) {
+                    chain.append(std::move(out));
+                    out.clear();
+                }
+                if (!chain.empty()) {
+                    // a write failing later breaks the connection, the receiver then fails the streams
+                    writer w{socket};
+                    if (auto err = w.write(std::exchange(chain, {}))) {
+                        fail(err);
+                    }
+                }
+            }
+
+            // returns read bytes to the peer once half a window has been consumed
+            void credit(stream_state& s, std::size_t n)
+            {
+                s.consumed += n;
+                if (s.consumed >= initial_window / 2 && !s.ended) {
+                    char payload[4];
+                    for (int i = 0; i < 4; ++i) {
+                        payload[i] = static_cast<char>(s.consumed >> (8 * (3 - i)));
+                    }
+                    send({4, s.id, frame_type::window, 0, s.method}, std::string_view{payload, 4});
+                    s.consumed = 0;
+                }
+            }
+
+            void reset(stream_state& s)
+            {
+                send({0, s.id, frame_type::reset, 0, s.method}, std::string_view{});
+                s.sent_end = true;
+            }
+
+            stream_state& open_stream(uint32_t id, uint16_t method)
+            {
+                auto s = new stream_state{};
+                s->ch = this;
+                s->id = id;
+                s->method = method;
+                return *streams.emplace(id, s).first->second;
+            }
+
+            void close_stream(stream_state& s)
+            {
+                if (!closed && !status && (!s.sent_end || !s.ended)) {
+                    reset(s);
+                }
+                streams.erase(s.id);
+            }
+
+            // waking may drop streams, so the waiting ones are collected first
+            void fail(error_code err)
+            {
+                status = err;
+                std::vector<uint32_t> ids;
+                for (auto& [id, s] : streams) {
+                    s->error = err;
+                    ids.push_back(id);
+                }
+                for (auto id : ids) {
+                    if (auto found = streams.find(id); found != streams.end()) {
+                        found->second->wake();
+                    }
+                }
+            }
+
+            // calls still waiting fail, states still held by a stream object are handed over to it
+            void tear_down()
+            {
+                closed = true;
+                input.reset();
+                fail(status ? status : error_code{UV_ECANCELED});
+                for (auto it = streams.begin(); it != streams.end(); ) {
+                    if (it->second->held) {
+                        it->second.release()->ch = nullptr;
+                        it = streams.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            void accept_stream(const frame_header& h, std::string_view payload);
+            void dispatch(const frame_header& h, std::string_view payload);
+        };
+
+        struct channel_deleter
+        {
+            void operator()(channel* ch) const noexcept {
+                ch->tear_down();
+                close_handle(reinterpret_cast<uv_handle_t*>(&ch->flusher), [](uv_handle_t* flusher) {
+                    delete static_cast<channel*>(flusher->data);
+                });
+            }
+        };
+
+        using channel_ptr = std::unique_ptr<channel, channel_deleter>;
+
+        inline task<void, error_code> receive(channel& ch)
+        {
+            auto& input = *ch.input;
+            while (!ch.closed) {
+                auto head = co_await input.read_exact(header_size);
+                if (!head) {
+                    ch.fail(head.error());
+                    co_return head.error();
+                }
+                auto h = frame_header::decode(head.value());
+                if (h.length > max_frame) {
+                    ch.fail(UV_EPROTO);
+                    co_return error_code{UV_EPROTO};
+                }
+                std::string_view payload;
+                if (h.length) {
+                    auto body = co_await input.read_exact(h.length);
+                    if (!body) {
+                        ch.fail(body.error());
+                        co_return body.error();
+                    }
+                    payload = body.value();
+                }
+                ch.dispatch(h, payload);
+            }
+            co_return error_code{0};
+        }
+    }
+
+    // one call as seen from either side, the client opens it and the server's handler gets it
+    class stream
+    {
+        detail::stream_state* s;
+
+        struct wait_for
+        {
+            std::coroutine_handle<>& slot;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) noexcept { slot = h; }
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        stream(detail::stream_state& s) noexcept : s{&s}
+        {
+            s.held = true;
+        }
+
+        stream(stream&& other) noexcept : s{std::exchange(other.s, nullptr)} {}
+        stream(const stream&) = delete;
+
+        // a stream dropped before both sides ended is reset. One that outlived its channel
+        // owns the state and fails every call with UV_ECANCELED
+        ~stream()
+        {
+            if (!s) {
+                return;
+            }
+            if (s->ch) {
+                s->held = false;
+                s->ch->close_stream(*s);
+            } else {
+                delete s;
+            }
+        }
+
+        uint16_t method() const noexcept { return s->method; }
+
+        // split into frames, waits whenever the peer's window is used up
+        task<void, error_code> write(std::string data, bool last = false)
+        {
+            std::size_t offset = 0;
+            do {
+                while (s->send_window <= 0 && !s->error) {
+                    co_await wait_for{s->writer};
+                }
+                if (s->error) {
+                    co_return s->error;
+                }
+                std::size_t n = std::min({data.size() - offset, max_frame, static_cast<std::size_t>(s->send_window)});
+                uint8_t flags = s->opened ? 0 : open;
+                if (last && offset + n == data.size()) {
+                    flags |= end;
+                    s->sent_end = true;
+                }
+                frame_header h{static_cast<uint32_t>(n), s->id, frame_type::data, flags, s->method};
+                if (n == data.size()) {
+                    s->ch->send(h, std::move(data));
+                } else {
+                    s->ch->send(h, std::string_view{data}.substr(offset, n));
+                }
+                s->opened = true;
+                s->send_window -= n;
+                offset += n;
+            } while (offset < data.size());
+            co_return error_code{0};
+        }
+
+        // the next chunk as received, nullopt once the peer ended the stream
+        task<std::optional<std::string>, error_code> read()
+        {
+            while (s->chunks.empty() && !s->ended && !s->error) {
+                co_await wait_for{s->reader};
+            }
+            if (!s->chunks.empty()) {
+                std::string chunk = std::move(s->chunks.front());
+                s->chunks.pop_front();
+                if (s->ch) {
+                    s->ch->credit(*s, chunk.size());
+                }
+                co_return std::optional<std::string>{std::move(chunk)};
+            }
+            if (s->error) {
+                co_return s->error;
+            }
+            co_return std::optional<std::string>{};
+        }
+
+        // everything up to the peer's end
+        task<std::string, error_code> read_all()
+        {
+            std::string message;
+            while (true) {
+                auto chunk = co_await read();
+                if (!chunk) {
+                    co_return chunk.error();
+                }
+                if (!chunk.value()) {
+                    co_return message;
+                }
+                message += *chunk.value();
+            }
+        }
+    };
+
+    // the handler starts with whatever came along with the open frame
+    inline void detail::channel::accept_stream(const frame_header& h, std::string_view payload)
+    {
+        auto& s = open_stream(h.stream, h.method);
+        s.opened = true;
+        s.ended = h.flags & end;
+        if (!payload.empty()) {
+            s.chunks.emplace_back(payload);
+        }
+        auto found = handlers->find(h.method);
+        if (found == handlers->end()) {
+            close_stream(s);
+            return;
+        }
+        running.spawn([](channel& ch, stream_state& s, const handler& run) -> task<> {
+            stream call{s};
+            auto done = co_await run(call);
+            if (!done) {
+                ch.reset(s);
+            } else if (!s.sent_end) {
+                co_await call.write({}, true);
+            }
+        }(*this, s, found->second));
+    }
+
+    inline void detail::channel::dispatch(const frame_header& h, std::string_view payload)
+    {
+        auto found = streams.find(h.stream);
+        if (found == streams.end()) {
+            // a new call, anything else is for a stream this side already dropped
+            if (h.type == frame_type::data && (h.flags & open) && handlers) {
+                accept_stream(h, payload);
+            }
+            return;
+        }
+        auto& s = *found->second;
+        switch (h.type) {
+        case frame_type::data:
+            if (!payload.empty()) {
+                s.chunks.emplace_back(payload);
+            }
+            if (h.flags & end) {
+                s.ended = true;
+            }
+            if (s.reader) {
+                std::exchange(s.reader, nullptr).resume();
+            }
+            break;
+        case frame_type::window:
+            if (payload.size() == 4) {
+                int64_t credit = 0;
+                for (char c : payload) {
+                    credit = credit << 8 | static_cast<uint8_t>(c);
+                }
+                s.send_window += credit;
+                if (s.writer) {
+                    std::exchange(s.writer, nullptr).resume();
+                }
+            }
+            break;
+        case frame_type::reset:
+            s.error = UV_ECONNRESET;
+            s.ended = true;
+            s.sent_end = true;
+            s.wake();
+            break;
+        }
+    }
+
+    class client
+    {
+        detail::channel_ptr ch;
+
+    public:
+        client() = default;
+        client(client&&) = default;
+        client& operator=(client&&) = default;
+
+        task<void, error_code> connect(const char* ip, int port, const tcp_options& options = {.nodelay = true})
+        {
+            tcp socket;
+            auto err = co_await socket.connect(ip, port, options);
+            if (err) {
+                co_return err;
+            }
+            ch.reset(new detail::channel{std::move(socket), nullptr});
+            ch->receiver.emplace(detail::receive(*ch));
+            co_return error_code{0};
+        }
+
+        // a streaming call, the request goes out with the first write
+        stream open(uint16_t method)
+        {
+            uint32_t id = ch->next_id;
+            ch->next_id += 2;
+            auto& s = ch->open_stream(id, method);
+            if (ch->status) {
+                s.error = ch->status;
+            }
+            return stream{s};
+        }
+
+        // one request, one response
+        task<std::string, error_code> call(uint16_t method, std::string request)
+        {
+            auto s = open(method);
+            auto sent = co_await s.write(std::move(request), true);
+            if (!sent) {
+                co_return sent.error();
+            }
+            auto response = co_await s.read_all();
+            co_return std::move(response);
+        }
+    };
+
+    class server
+    {
+        std::unordered_map<uint16_t, handler> handlers;
+
+    public:
+        // register every method before serving, the table is shared by all loops
+        void handle(uint16_t method, handler h)
+        {
+            handlers[method] = std::move(h);
+        }
+
+        // serves one connection on the calling loop until it closes
+        task<> serve(tcp socket)
+        {
+            detail::channel_ptr ch{new detail::channel{std::move(socket), &handlers}};
+            auto& receiver = ch->receiver.emplace(detail::receive(*ch));
+            co_await receiver;
+            co_await ch->running.join();
+        }
+
+        // accepts on the calling loop and hands each connection to the next of loops in turn,
+        // without loops every connection is served here
+        task<void, error_code> listen(const char* ip, int port, std::vector<event_loop*> loops = {}, int backlog = 128)
+        {
+            tcp acceptor;
+            if (auto err = acceptor.bind(ip, port, {.nodelay = true})) {
+                co_return err;
+            }
+            auto listner = acceptor.listen(backlog);
+            task_group local;
+            std::size_t next = 0;
+            while (true) {
+                int status = co_await listner;
+                if (status) {
+                    co_return error_code{status};
+                }
+                tcp socket;
+                if (acceptor.accept(socket)) {
+                    continue;
+                }
+                if (loops.empty()) {
+                    local.spawn(serve(std::move(socket)));
+                    continue;
+                }
+                // a connection that can not be handed over is dropped, the next one may still be
+                auto fd = socket.detach();
+                if (fd == -1) {
+                    continue;
+                }
+                spawn(*loops[next++ % loops.size()], [this](uv_os_sock_t fd) -> task<> {
+                    tcp socket;
+                    if (socket.open(fd)) {
+                        ::close(fd);
+                        co_return std::exception_ptr{};
+                    }
+                    co_await serve(std::move(socket));
+                }, fd);
+            }
+        }
+    };
+}
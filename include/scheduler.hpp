@@ -0,0 +1,410 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+
+namespace couv
+{
+    struct schedule_node
+    {
+        schedule_node* next{nullptr};
+        std::coroutine_handle<> co_handle;
+    };
+
+    class event_loop;
+
+    // completion slot embedded in awaitable state, queued on the loop in deferred mode
+    class ready_node
+    {
+        ready_node* prev{nullptr};
+        ready_node* next{nullptr};
+        event_loop* owner{nullptr};
+        std::coroutine_handle<> co_handle;
+        uint64_t queued_at{0};
+
+        friend class event_loop;
+
+        void unlink() noexcept;
+
+    public:
+        ready_node() = default;
+        ready_node(const ready_node&) = delete;
+        ready_node& operator=(const ready_node&) = delete;
+
+        ~ready_node() 
+        {
+            cancel();
+        }
+
+        bool queued() const noexcept { return prev != nullptr; }
+
+        // owners call this before their state can no longer be resumed
+        void cancel() noexcept
+        {
+            if (queued()) {
+                unlink();
+            }
+        }
+
+        // resumes h inline, or queues it when the loop runs in deferred mode
+        void resume(uv_loop_t* loop, std::coroutine_handle<> h);
+
+        static bool deferred_on(uv_loop_t* loop) noexcept;
+    };
+
+    struct batch_stats
+    {
+        std::size_t resumed{0};
+        std::size_t pending{0};
+        uint64_t max_latency{0};   // nanoseconds from completion to resumption
+        uint64_t total_latency{0};
+    };
+
+    // told whenever its loop is between callbacks, from a check handle once every iteration
+    class quiescent_hook
+    {
+    public:
+        // tells the hooks of different users of a loop apart
+        const void* const kind;
+
+        explicit quiescent_hook(const void* kind) noexcept : kind{kind} {}
+
+        virtual void quiescent() noexcept = 0;
+
+        // the loop is being destroyed, the hook has been removed already
+        virtual void loop_closing() noexcept = 0;
+
+    protected:
+        ~quiescent_hook() = default;
+    };
+
+    class event_loop
+    {
+        uv_loop_t* loop;
+        uv_async_t async_handle;
+        std::atomic<schedule_node*> head{nullptr};
+        std::atomic<bool> stopping{false};
+        bool owned;
+
+        uv_check_t check_handle;
+        uv_idle_t idle_handle;
+        uv_check_t quiescent_handle;
+        std::vector<quiescent_hook*> hooks;
+        ready_node ready;
+        std::size_t queued{0};
+        std::size_t batch_size{0};
+        batch_stats stats;
+
+        friend class ready_node;
+
+        event_loop(uv_loop_t* loop, bool owned) : loop{loop}, owned{owned}
+        {
+            loop->data = this;
+            async_handle.data = this;
+            uv_async_init(loop, &async_handle, [](uv_async_t* async_handle) {
+                static_cast<event_loop*>(async_handle->data)->drain();
+            });
+            if (!owned) {
+                uv_unref(reinterpret_cast<uv_handle_t*>(&async_handle));
+            }
+
+            ready.prev = ready.next = &ready;
+            check_handle.data = this;
+            uv_check_init(loop, &check_handle);
+            uv_unref(reinterpret_cast<uv_handle_t*>(&check_handle));
+            uv_idle_init(loop, &idle_handle);
+            quiescent_handle.data = this;
+            uv_check_init(loop, &quiescent_handle);
+            uv_unref(reinterpret_cast<uv_handle_t*>(&quiescent_handle));
+        }
+
+        void enqueue(ready_node* node, std::coroutine_handle<> h) noexcept
+        {
+            node->co_handle = h;
+            node->owner = this;
+            node->queued_at = uv_hrtime();
+            node->prev = ready.prev;
+            node->next = &ready;
+            ready.prev->next = node;
+            ready.prev = node;
+            ++queued;
+            // keeps the next poll from blocking while completions wait
+            uv_idle_start(&idle_handle, [](uv_idle_t*) {});
+        }
+
+        void run_ready() noexcept
+        {
+            uv_loop_t* previous = std::exchange(running_loop, loop);
+            stats = {};
+            while (stats.resumed < batch_size && ready.next != &ready) {
+                auto node = ready.next;
+                node->unlink();
+                // the resumes before this one are part of its wait
+                uint64_t latency = uv_hrtime() - node->queued_at;
+                stats.max_latency = std::max(stats.max_latency, latency);
+                stats.total_latency += latency;
+                ++stats.resumed;
+                std::exchange(node->co_handle, nullptr)();
+            }
+            stats.pending = queued;
+            if (!queued) {
+                uv_idle_stop(&idle_handle);
+            }
+            running_loop = previous;
+        }
+
+        static uv_loop_t* new_loop()
+        {
+            auto loop = new uv_loop_t;
+            uv_loop_init(loop);
+            return loop;
+        }
+
+        void drain() noexcept
+        {
+            if (stopping.load(std::memory_order_acquire)) {
+                uv_unref(reinterpret_cast<uv_handle_t*>(&async_handle));
+            }
+
+            // the stack is LIFO, reverse it so nodes run in posting order
+            schedule_node* node = head.exchange(nullptr, std::memory_order_acquire);
+            schedule_node* fifo = nullptr;
+            while (node) {
+                auto next = node->next;
+                node->next = fifo;
+                fifo = node;
+                node = next;
+            }
+
+            uv_loop_t* previous = std::exchange(running_loop, loop);
+            while (fifo) {
+                // the node lives in the resumed frame, so step past it first
+                auto co_handle = fifo->co_handle;
+                fifo = fifo->next;
+                co_handle();
+            }
+            running_loop = previous;
+        }
+
+    public:
+        event_loop() : event_loop{new_loop(), true} {}
+
+        event_loop(const event_loop&) = delete;
+        event_loop& operator=(const event_loop&) = delete;
+
+        ~event_loop()
+        {
+            if (owned) {
+                while (ready.next != &ready) {
+                    ready.next->unlink();
+                }
+                ready.unlink();
+                close_hooks();
+                close_handle(reinterpret_cast<uv_handle_t*>(&quiescent_handle), nullptr);
+                close_handle(reinterpret_cast<uv_handle_t*>(&check_handle), nullptr);
+                close_handle(reinterpret_cast<uv_handle_t*>(&idle_handle), nullptr);
+                close_handle(reinterpret_cast<uv_handle_t*>(&async_handle), nullptr);
+                uv_run(loop, UV_RUN_DEFAULT);
+                uv_loop_close(loop);
+                delete loop;
+            }
+        }
+
+        // the default loop; its scheduler handle does not keep couv::loop() alive
+        static event_loop& main()
+        {
+            static event_loop instance{uv_default_loop(), false};
+            return instance;
+        }
+
+        // the event_loop of the calling thread's loop
+        static event_loop& current()
+        {
+            auto loop = current_loop();
+            [[likely]] if (loop->data) {
+                return *static_cast<event_loop*>(loop->data);
+            }
+            return main();
+        }
+
+        uv_loop_t* get() const noexcept { return loop; }
+
+        // completions are queued and resumed from a check handle, at most batch per loop iteration,
+        // so one busy stream can not starve the others. batch 0 resumes inline again
+        void set_deferred(std::size_t batch = 64) noexcept
+        {
+            batch_size = batch;
+            if (batch) {
+                uv_check_start(&check_handle, [](uv_check_t* check_handle) {
+                    static_cast<event_loop*>(check_handle->data)->run_ready();
+                });
+            } else {
+                uv_check_stop(&check_handle);
+                batch_size = SIZE_MAX;
+                run_ready();
+                batch_size = 0;
+            }
+        }
+
+        bool deferred() const noexcept { return batch_size != 0; }
+
+        const batch_stats& last_batch() const noexcept { return stats; }
+
+        int run()
+        {
+            uv_loop_t* previous = std::exchange(running_loop, loop);
+            int ret = uv_run(loop, UV_RUN_DEFAULT);
+            running_loop = previous;
+            return ret;
+        }
+
+        // thread safe, run() returns once the loop has no other work left
+        void stop() noexcept
+        {
+            stopping.store(true, std::memory_order_release);
+            uv_async_send(&async_handle);
+        }
+
+        // loop thread only and not from inside quiescent(), a hook is removed before it is destroyed
+        void add_hook(quiescent_hook* hook)
+        {
+            if (hooks.empty()) {
+                uv_check_start(&quiescent_handle, [](uv_check_t* quiescent_handle) {
+                    for (auto hook : static_cast<event_loop*>(quiescent_handle->data)->hooks) {
+                        hook->quiescent();
+                    }
+                });
+            }
+            hooks.push_back(hook);
+        }
+
+        void remove_hook(quiescent_hook* hook) noexcept
+        {
+            hooks.erase(std::remove(hooks.begin(), hooks.end(), hook), hooks.end());
+            if (hooks.empty()) {
+                uv_check_stop(&quiescent_handle);
+            }
+        }
+
+        // for a loop that is done running but stays around, like the default one
+        void close_hooks() noexcept
+        {
+            uv_check_stop(&quiescent_handle);
+            for (auto hook : std::exchange(hooks, {})) {
+                hook->loop_closing();
+            }
+        }
+
+        quiescent_hook* find_hook(const void* kind) const noexcept
+        {
+            for (auto hook : hooks) {
+                if (hook->kind == kind) {
+                    return hook;
+                }
+            }
+            return nullptr;
+        }
+
+        // thread safe, makes the loop run one more iteration even when it has nothing to do
+        void wake() noexcept
+        {
+            uv_async_send(&async_handle);
+        }
+
+        // thread safe, node->co_handle is resumed on this loop's thread
+        void post(schedule_node* node) noexcept
+        {
+            node->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(node->next, node,
+                std::memory_order_release, std::memory_order_relaxed)) {}
+            uv_async_send(&async_handle);
+        }
+    };
+
+    inline void ready_node::unlink() noexcept
+    {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+        if (owner) {
+            --std::exchange(owner, nullptr)->queued;
+        }
+    }
+
+    inline bool ready_node::deferred_on(uv_loop_t* loop) noexcept
+    {
+        auto target = static_cast<event_loop*>(loop->data);
+        return target && target->deferred();
+    }
+
+    inline void ready_node::resume(uv_loop_t* loop, std::coroutine_handle<> h)
+    {
+        [[likely]] if (!deferred_on(loop)) {
+            h();
+        } else {
+            static_cast<event_loop*>(loop->data)->enqueue(this, h);
+        }
+    }
+
+    class schedule_awaiter : schedule_node
+    {
+        event_loop& target;
+
+    public:
+        schedule_awaiter(event_loop& target) noexcept : target{target} {}
+
+        bool await_ready() const noexcept {
+            return target.get() == current_loop();
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            co_handle = h;
+            target.post(this);
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    inline schedule_awaiter schedule_on(event_loop& target) noexcept
+    {
+        return {target};
+    }
+
+    struct detached
+    {
+        struct promise_type
+        {
+            detached get_return_object() const noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() const noexcept {}
+            // nobody awaits a spawned call, so an exception escaping it cannot be reported
+            [[noreturn]] void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    // calls f(args...) on target and keeps the returned awaitable alive until it completes.
+    // An exception escaping f terminates the process, like one escaping a thread
+    template <typename F, typename... Args>
+    void spawn(event_loop& target, F f, Args... args)
+    {
+        [](event_loop& target, F f, Args... args) -> detached {
+            co_await schedule_on(target);
+            co_await f(std::move(args)...);
+        }(target, std::move(f), std::move(args)...);
+    }
+}
@@ -0,0 +1,203 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+#include <task.hpp>
+#include <tcp.hpp>
+#include <timer.hpp>
+#include <signal.hpp>
+#include <error_code.hpp>
+
+extern char** environ;
+
+namespace couv
+{
+    // listening sockets handed off by the previous process, fd 3 onwards in handoff order
+    inline uv_os_sock_t inherited_listener(std::size_t index) noexcept
+    {
+        const char* count = std::getenv("COUV_LISTEN_FDS");
+        if (!count || index >= std::strtoul(count, nullptr, 10)) {
+            return -1;
+        }
+        return static_cast<uv_os_sock_t>(3 + index);
+    }
+
+    // starts argv again as a new process that inherits the listening sockets, it opens them with
+    // inherited_listener and accepts on the same queues while this process drains
+    inline error_code handoff(char* const argv[], std::initializer_list<const tcp*> listeners)
+    {
+        std::vector<uv_stdio_container_t> stdio(3 + listeners.size());
+        for (int fd = 0; fd < 3; ++fd) {
+            stdio[fd].flags = UV_INHERIT_FD;
+            stdio[fd].data.fd = fd;
+        }
+        std::size_t slot = 3;
+        for (auto listener : listeners) {
+            stdio[slot].flags = UV_INHERIT_FD;
+            stdio[slot++].data.fd = listener->fileno();
+        }
+
+        std::vector<std::string> variables;
+        for (char** e = environ; *e; ++e) {
+            if (std::strncmp(*e, "COUV_LISTEN_FDS=", 16) != 0) {
+                variables.emplace_back(*e);
+            }
+        }
+        variables.push_back("COUV_LISTEN_FDS=" + std::to_string(listeners.size()));
+        std::vector<char*> env;
+        for (auto& v : variables) {
+            env.push_back(v.data());
+        }
+        env.push_back(nullptr);
+
+        char path[4096];
+        std::size_t size = sizeof(path);
+        if (auto err = uv_exepath(path, &size)) {
+            return err;
+        }
+
+        uv_process_options_t options{};
+        options.file = path;
+        options.args = const_cast<char**>(argv);
+        options.env = env.data();
+        options.stdio = stdio.data();
+        options.stdio_count = static_cast<int>(stdio.size());
+        options.flags = UV_PROCESS_DETACHED;
+
+        // the new process outlives this one, its handle is not kept
+        auto process = new uv_process_t;
+        error_code err = uv_spawn(current_loop(), process, &options);
+        uv_close(reinterpret_cast<uv_handle_t*>(process), [](uv_handle_t* process) {
+            delete reinterpret_cast<uv_process_t*>(process);
+        });
+        return err;
+    }
+
+    // graceful stop in phases. Groups registered with stop are cancelled first, which closes
+    // the listeners their accept loops own. Groups registered with drain get until the deadline
+    // to finish, then they are cancelled too. Writes already queued keep their sockets open and
+    // are flushed within what is left of the deadline
+    class shutdown
+    {
+        std::vector<task_group*> stopped;
+        std::vector<task_group*> drained;
+        std::deque<int> received;
+        timer wake;
+        task_group watchers;
+        bool started{false};
+
+        static task<> watch(int signum, std::deque<int>& received, timer& wake)
+        {
+            couv::signal signal{signum};
+            while (true) {
+                received.push_back(co_await signal);
+                wake.start(0);
+            }
+        }
+
+        static task<> joined(task_group& group, std::size_t& left, timer& deadline)
+        {
+            co_await group.join();
+            if (--left == 0) {
+                deadline.start(0);
+            }
+        }
+
+    public:
+        shutdown(std::initializer_list<int> signals = {SIGINT, SIGTERM, SIGHUP})
+        {
+            for (int signum : signals) {
+                watchers.spawn(watch(signum, received, wake));
+            }
+        }
+
+        shutdown(const shutdown&) = delete;
+        shutdown& operator=(const shutdown&) = delete;
+
+        void stop(task_group& group) { stopped.push_back(&group); }
+        void drain(task_group& group) { drained.push_back(&group); }
+
+        // as if a signal arrived, wait returns 0
+        void request()
+        {
+            received.push_back(0);
+            wake.start(0);
+        }
+
+        bool stopping() const noexcept { return started; }
+
+        // the next signal number, SIGHUP is the usual cue to handoff before running
+        task<int> wait()
+        {
+            while (received.empty()) {
+                co_await wake;
+            }
+            int signum = received.front();
+            received.pop_front();
+            co_return signum;
+        }
+
+        static bool writing(uv_loop_t* loop) noexcept
+        {
+            bool pending = false;
+            uv_walk(loop, [](uv_handle_t* handle, void* pending) {
+                auto type = uv_handle_get_type(handle);
+                if ((type == UV_TCP || type == UV_NAMED_PIPE || type == UV_TTY) && !uv_is_closing(handle) &&
+                    uv_stream_get_write_queue_size(reinterpret_cast<uv_stream_t*>(handle))) {
+                    *static_cast<bool*>(pending) = true;
+                }
+            }, &pending);
+            return pending;
+        }
+
+        // runs the phases and waits for queued writes, then closes what tasks nobody registered
+        // still hold and stops the loop. Their owners can still be destroyed afterwards
+        task<> run(uint64_t deadline_ms = 30000)
+        {
+            started = true;
+            watchers.cancel();
+            for (auto group : stopped) {
+                group->cancel();
+            }
+
+            auto loop = current_loop();
+            uint64_t end = uv_now(loop) + deadline_ms;
+            timer deadline;
+            std::size_t left = drained.size();
+            task_group joins;
+            for (auto group : drained) {
+                joins.spawn(joined(*group, left, deadline));
+            }
+            if (left) {
+                deadline.start(deadline_ms);
+                co_await deadline;
+            }
+
+            // cancelling resumes the joins still waiting, so they end before their group
+            for (auto group : drained) {
+                group->cancel();
+            }
+
+            while (writing(loop) && uv_now(loop) < end) {
+                deadline.start(1);
+                co_await deadline;
+            }
+            close_all(loop);
+            uv_stop(loop);
+        }
+    };
+}
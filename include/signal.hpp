@@ -9,16 +9,21 @@
 #include <iostream>
 #include <memory>
 #include <error_code.hpp>
+#include <tick.hpp>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
 
 namespace couv
 {
     class signal
     {
-        struct signal_data {
+        struct signal_data : slab_allocated<signal_data> {
             uv_signal_t signal_handle;
             std::coroutine_handle<> co_handle;
+            ready_node node;
             int ready{0};
             int signum;
         };
@@ -26,7 +31,8 @@ namespace couv
         struct signal_deleter
         {
             void operator()(signal_data* data) const noexcept {
-                uv_close(reinterpret_cast<uv_handle_t*>(&data->signal_handle), [](uv_handle_t* signal_handle) {
+                data->node.cancel();
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->signal_handle), [](uv_handle_t* signal_handle) {
                     delete static_cast<signal_data*>(signal_handle->data);
                 });
             }
@@ -38,7 +44,7 @@ namespace couv
         signal() : 
             data{new signal_data{}, signal_deleter{}}
         {
-            uv_signal_init(uv_default_loop(), &data->signal_handle);
+            uv_signal_init(current_loop(), &data->signal_handle);
             data->signal_handle.data = data.get();
         }
 
@@ -53,7 +59,7 @@ namespace couv
                 ++data->ready;
                 data->signum = signum;
                 [[likely]] if (data->co_handle) {
-                    data->co_handle();
+                    data->node.resume(signal_handle->loop, std::exchange(data->co_handle, nullptr));
                 }
             }, signum);
         }
@@ -75,5 +81,9 @@ namespace couv
             --data->ready; 
             return data->signum;
         };
+
+        tick_awaiter<signal_data> ticks() noexcept {
+            return {*data, data->signal_handle.loop};
+        }
     };
 }
\ No newline at end of file
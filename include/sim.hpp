@@ -0,0 +1,693 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <error_code.hpp>
+#include <loop.hpp>
+#include <pipe.hpp>
+
+#include <uv.h> // libuv
+#include <sys/socket.h>
+#include <unistd.h>
+
+// deterministic in process simulation: a virtual time loop with timer and stream awaitables
+// shaped like couv::timer, couv::tcp, reader, writer and connector.
+// Those are separate implementations. To test couv::reader and couv::writer themselves, a wire
+// joins two real couv::pipe ends through a simulated link. couv::timer and couv::connector have
+// no virtual time counterpart, they need the sim types
+namespace couv::sim
+{
+    struct link
+    {
+        uint64_t latency{0};        // one way, nanoseconds
+        uint64_t bandwidth{0};      // bytes per second, 0 is unlimited
+        double loss{0};             // segment loss probability
+        uint64_t rto{200'000'000};  // retransmission delay of a lost segment, nanoseconds
+        std::size_t mss{1460};
+    };
+
+    class event_target : public std::enable_shared_from_this<event_target>
+    {
+    public:
+        virtual ~event_target() = default;
+        virtual void fire(uint64_t id) = 0;
+    };
+
+    // moves bytes between real handles and the simulation when polled, returns whether it did
+    class io_pump
+    {
+    public:
+        virtual ~io_pump() = default;
+        virtual bool pump() = 0;
+    };
+
+    // single threaded event queue ordered by virtual time, ties run in scheduling order
+    class virtual_loop
+    {
+        struct event
+        {
+            uint64_t at;
+            uint64_t id;
+            std::shared_ptr<event_target> target;
+
+            bool operator>(const event& e) const noexcept {
+                return at != e.at ? at > e.at : id > e.id;
+            }
+        };
+
+        std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+        std::mt19937_64 rng;
+        uint64_t time{0};
+        uint64_t next_id{0};
+        uint64_t fired{0};
+        std::vector<io_pump*> pumps;
+        virtual_loop* previous;
+
+        static virtual_loop*& running() noexcept
+        {
+            static thread_local virtual_loop* loop = nullptr;
+            return loop;
+        }
+
+    public:
+        // becomes the current loop of this thread until destroyed
+        explicit virtual_loop(uint64_t seed = 0) : rng{seed}, previous{std::exchange(running(), this)} {}
+
+        virtual_loop(const virtual_loop&) = delete;
+        virtual_loop& operator=(const virtual_loop&) = delete;
+
+        ~virtual_loop()
+        {
+            running() = previous;
+        }
+
+        static virtual_loop& current() noexcept
+        {
+            return *running();
+        }
+
+        // nanoseconds since the loop was created
+        uint64_t now() const noexcept { return time; }
+
+        // events fired so far
+        uint64_t count() const noexcept { return fired; }
+
+        uint64_t schedule(uint64_t at, std::shared_ptr<event_target> target)
+        {
+            events.push({std::max(at, time), ++next_id, std::move(target)});
+            return next_id;
+        }
+
+        double uniform() noexcept
+        {
+            return std::uniform_real_distribution<double>{}(rng);
+        }
+
+        void attach(io_pump* p) { pumps.push_back(p); }
+        void detach(io_pump* p) { std::erase(pumps, p); }
+
+        // runs the libuv loop without blocking until neither it nor the pumps move anything.
+        // A write completes on the libuv iteration after the bytes left, hence two quiet rounds
+        void settle()
+        {
+            for (int quiet = 0; !pumps.empty() && quiet < 2;) {
+                uv_run(current_loop(), UV_RUN_NOWAIT);
+                bool moved = false;
+                for (auto p : pumps) {
+                    moved |= p->pump();
+                }
+                quiet = moved ? 0 : quiet + 1;
+            }
+        }
+
+        // fast forwards through the events up to until, returns the number fired.
+        // With a wire attached it runs the libuv loop too, so it must not be called from inside it
+        uint64_t run(uint64_t until = UINT64_MAX)
+        {
+            uint64_t start = fired;
+            settle();
+            while (!events.empty() && events.top().at <= until) {
+                // keeps the target alive while it resumes coroutines that may drop their reference
+                event e = events.top();
+                events.pop();
+                time = e.at;
+                ++fired;
+                e.target->fire(e.id);
+                settle();
+            }
+            if (until != UINT64_MAX) {
+                time = std::max(time, until);
+            }
+            return fired - start;
+        }
+    };
+
+    class timer
+    {
+        struct timer_data : event_target
+        {
+            std::coroutine_handle<> co_handle;
+            uint64_t armed{0};
+            int ready{0};
+
+            void fire(uint64_t id) override
+            {
+                if (id != armed) {
+                    return;
+                }
+                armed = 0;
+                ++ready;
+                if (co_handle) {
+                    std::exchange(co_handle, nullptr)();
+                }
+            }
+        };
+
+        virtual_loop& loop;
+        std::shared_ptr<timer_data> data;
+
+    public:
+        timer() : loop{virtual_loop::current()}, data{std::make_shared<timer_data>()} {}
+
+        // timeout in milliseconds, like couv::timer
+        timer(uint64_t timeout) : timer{}
+        {
+            start(timeout);
+        }
+
+        timer(timer&&) = default;
+
+        ~timer()
+        {
+            if (data) {
+                stop();
+            }
+        }
+
+        void start(uint64_t timeout)
+        {
+            data->armed = loop.schedule(loop.now() + timeout * 1'000'000, data);
+        }
+
+        void stop() noexcept
+        {
+            data->armed = 0;
+            data->co_handle = nullptr;
+        }
+
+        bool await_ready() const noexcept { return data->ready; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->co_handle = h; }
+        void await_resume() noexcept { --data->ready; }
+    };
+
+    // one direction of a connection, bytes arrive in order after serialization, latency and retransmits
+    class pipe : public event_target
+    {
+        struct segment
+        {
+            uint64_t arrival;
+            std::string bytes;
+            bool fin;
+        };
+
+        virtual_loop& loop;
+        link shape;
+        std::deque<segment> in_flight;
+        uint64_t busy_until{0};
+        uint64_t last_arrival{0};
+        bool scheduled{false};
+
+        friend class stream;
+        friend class reader;
+        friend class writer;
+        friend class acceptor;
+        friend class wire;
+
+        std::string received;
+        std::coroutine_handle<> co_handle;
+        bool eof{false};
+        bool closed{false};
+        bool shut{false};
+
+        void wake()
+        {
+            if (co_handle && (!received.empty() || eof)) {
+                std::exchange(co_handle, nullptr)();
+            }
+        }
+
+    public:
+        pipe(virtual_loop& loop, const link& shape) : loop{loop}, shape{shape} {}
+
+        // returns the virtual time the last byte left the sender
+        uint64_t send(std::string_view bytes, bool fin = false)
+        {
+            uint64_t t = std::max(loop.now(), busy_until);
+            do {
+                auto chunk = bytes.substr(0, shape.mss);
+                bytes.remove_prefix(chunk.size());
+                if (shape.bandwidth) {
+                    t += chunk.size() * 1'000'000'000 / shape.bandwidth;
+                }
+                uint64_t arrival = t + shape.latency;
+                while (shape.loss > 0 && loop.uniform() < shape.loss) {
+                    arrival += shape.rto;
+                }
+                // a retransmit holds back everything behind it
+                last_arrival = std::max(arrival, last_arrival);
+                in_flight.push_back({last_arrival, std::string{chunk}, fin && bytes.empty()});
+            } while (!bytes.empty());
+            busy_until = t;
+
+            if (!scheduled) {
+                scheduled = true;
+                loop.schedule(in_flight.front().arrival, shared_from_this());
+            }
+            return t;
+        }
+
+        void fire(uint64_t) override
+        {
+            scheduled = false;
+            while (!in_flight.empty() && in_flight.front().arrival <= loop.now()) {
+                auto& s = in_flight.front();
+                if (!closed) {
+                    received += s.bytes;
+                }
+                eof |= s.fin;
+                in_flight.pop_front();
+            }
+            if (!in_flight.empty()) {
+                scheduled = true;
+                loop.schedule(in_flight.front().arrival, shared_from_this());
+            }
+            wake();
+        }
+    };
+
+    class reader
+    {
+        std::shared_ptr<pipe> rx;
+        std::string buf;
+
+    public:
+        reader(std::shared_ptr<pipe> rx) : rx{std::move(rx)} {}
+        reader(reader&&) = default;
+
+        ~reader()
+        {
+            if (rx) {
+                rx->co_handle = nullptr;
+            }
+        }
+
+        bool await_ready() const noexcept { return !rx->received.empty() || rx->eof; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { rx->co_handle = h; }
+
+        // everything received so far, null at end of stream
+        const char* await_resume()
+        {
+            buf.clear();
+            if (rx->received.empty()) {
+                return nullptr;
+            }
+            buf.swap(rx->received);
+            return buf.c_str();
+        }
+
+        std::size_t size() const noexcept { return buf.size(); }
+    };
+
+    class writer
+    {
+        struct writer_data : event_target
+        {
+            std::coroutine_handle<> co_handle;
+            int status{1};
+
+            void fire(uint64_t) override
+            {
+                status = 0;
+                if (co_handle) {
+                    std::exchange(co_handle, nullptr)();
+                }
+            }
+        };
+
+        std::shared_ptr<writer_data> data;
+
+    public:
+        // completes once the last byte was serialized onto the link
+        writer(pipe& tx, std::string_view bytes) : data{std::make_shared<writer_data>()}
+        {
+            if (tx.shut || tx.closed) {
+                data->status = UV_EPIPE;
+                return;
+            }
+            uint64_t done = tx.send(bytes);
+            if (done <= tx.loop.now()) {
+                data->status = 0;
+            } else {
+                tx.loop.schedule(done, data);
+            }
+        }
+
+        writer(writer&&) = default;
+
+        ~writer()
+        {
+            if (data) {
+                data->co_handle = nullptr;
+            }
+        }
+
+        bool await_ready() const noexcept { return data->status <= 0; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->co_handle = h; }
+        error_code await_resume() const noexcept { return data->status; }
+    };
+
+    class acceptor;
+
+    class connector
+    {
+        struct connector_data : event_target
+        {
+            std::coroutine_handle<> co_handle;
+            int status{1};
+
+            void fire(uint64_t) override
+            {
+                status = 0;
+                if (co_handle) {
+                    std::exchange(co_handle, nullptr)();
+                }
+            }
+        };
+
+        std::shared_ptr<connector_data> data;
+        friend class stream;
+
+    public:
+        connector() : data{std::make_shared<connector_data>()} {}
+        connector(connector&&) = default;
+
+        ~connector()
+        {
+            if (data) {
+                data->co_handle = nullptr;
+            }
+        }
+
+        bool await_ready() const noexcept { return data->status <= 0; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->co_handle = h; }
+        error_code await_resume() const noexcept { return data->status; }
+    };
+
+    // in memory tcp connection end
+    class stream
+    {
+        std::shared_ptr<pipe> rx;
+        std::shared_ptr<pipe> tx;
+
+        friend class acceptor;
+
+    public:
+        stream() = default;
+        stream(stream&&) = default;
+        stream& operator=(stream&& s)
+        {
+            close();
+            rx = std::move(s.rx);
+            tx = std::move(s.tx);
+            return *this;
+        }
+
+        ~stream()
+        {
+            close();
+        }
+
+        // an already connected pair, sharing one link shape in both directions
+        static std::pair<stream, stream> pair(const link& shape = {})
+        {
+            auto& loop = virtual_loop::current();
+            stream a, b;
+            a.tx = b.rx = std::make_shared<pipe>(loop, shape);
+            a.rx = b.tx = std::make_shared<pipe>(loop, shape);
+            return {std::move(a), std::move(b)};
+        }
+
+        connector connect(acceptor& server, const link& shape = {});
+
+        reader read() { return {rx}; }
+
+        writer write(std::string_view bytes) { return {*tx, bytes}; }
+
+        // half close, the peer reads the end of stream after the data in flight
+        void shutdown()
+        {
+            if (tx && !tx->shut && !tx->closed) {
+                tx->shut = true;
+                tx->send({}, true);
+            }
+        }
+
+        void close()
+        {
+            shutdown();
+            if (rx) {
+                rx->closed = true;
+                rx->received.clear();
+                rx->co_handle = nullptr;
+            }
+        }
+    };
+
+    // accept queue, connections become ready after the handshake reached the server
+    class acceptor
+    {
+        struct acceptor_data : event_target
+        {
+            std::deque<std::pair<std::shared_ptr<pipe>, std::shared_ptr<pipe>>> pending;
+            std::coroutine_handle<> co_handle;
+            std::size_t backlog;
+            bool closed{false};
+
+            void fire(uint64_t) override
+            {
+                if (co_handle && !pending.empty()) {
+                    std::exchange(co_handle, nullptr)();
+                }
+            }
+        };
+
+        // the client reads the end of stream and its writes fail
+        static void refuse(pipe& rx, pipe& tx)
+        {
+            rx.closed = true;
+            tx.shut = true;
+            tx.send({}, true);
+        }
+
+        struct handshake : event_target
+        {
+            std::shared_ptr<acceptor_data> server;
+            std::shared_ptr<pipe> rx;
+            std::shared_ptr<pipe> tx;
+
+            void fire(uint64_t id) override
+            {
+                if (server->closed || server->pending.size() >= server->backlog) {
+                    refuse(*rx, *tx);
+                    return;
+                }
+                server->pending.emplace_back(std::move(rx), std::move(tx));
+                server->fire(id);
+            }
+        };
+
+        std::shared_ptr<acceptor_data> data;
+        friend class stream;
+
+    public:
+        acceptor(std::size_t backlog = 128) : data{std::make_shared<acceptor_data>()}
+        {
+            data->backlog = backlog;
+        }
+
+        ~acceptor()
+        {
+            data->closed = true;
+            data->co_handle = nullptr;
+            for (auto& [rx, tx] : data->pending) {
+                refuse(*rx, *tx);
+            }
+        }
+
+        error_code accept(stream& client)
+        {
+            if (data->pending.empty()) {
+                return UV_EAGAIN;
+            }
+            client.close();
+            std::tie(client.rx, client.tx) = std::move(data->pending.front());
+            data->pending.pop_front();
+            return 0;
+        }
+
+        bool await_ready() const noexcept { return !data->pending.empty(); }
+        void await_suspend(std::coroutine_handle<> h) noexcept { data->co_handle = h; }
+        error_code await_resume() const noexcept { return 0; }
+    };
+
+    // the client completes after one round trip, the server can accept half a round trip later
+    inline connector stream::connect(acceptor& server, const link& shape)
+    {
+        auto& loop = virtual_loop::current();
+        close();
+        tx = std::make_shared<pipe>(loop, shape);
+        rx = std::make_shared<pipe>(loop, shape);
+
+        auto one_way = [&] {
+            uint64_t delay = shape.latency;
+            while (shape.loss > 0 && loop.uniform() < shape.loss) {
+                delay += shape.rto;
+            }
+            return delay;
+        };
+        uint64_t established = loop.now() + one_way() + one_way();
+        auto syn = std::make_shared<acceptor::handshake>();
+        syn->server = server.data;
+        syn->rx = tx;
+        syn->tx = rx;
+        loop.schedule(established + one_way(), std::move(syn));
+
+        connector c;
+        loop.schedule(established, c.data);
+        return c;
+    }
+
+    // two real couv::pipe ends joined through a simulated link, couv::reader and couv::writer run
+    // on them unchanged while the bytes travel in virtual time. Each end is a unix socketpair,
+    // the wire holds the far sides and only reads a side while its link is free, so a slow link
+    // pushes back on the writer. The wire must not outlive the virtual loop
+    class wire : io_pump
+    {
+        struct side
+        {
+            int fd{-1};
+            std::shared_ptr<pipe> tx;
+            bool eof{false};
+            bool shut{false};
+        };
+
+        // run() settles after every event, this one only marks when a busy link frees up
+        struct link_free : event_target
+        {
+            void fire(uint64_t) override {}
+        };
+
+        virtual_loop& loop;
+        couv::pipe ends[2];
+        side sides[2];
+        std::shared_ptr<link_free> free{std::make_shared<link_free>()};
+
+        bool send(side& s)
+        {
+            char buf[64 * 1024];
+            bool moved = false;
+            while (!s.eof && s.tx->busy_until <= loop.now()) {
+                auto n = ::read(s.fd, buf, sizeof(buf));
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    break;
+                }
+                s.eof = n <= 0;
+                uint64_t done = s.tx->send({buf, s.eof ? 0 : static_cast<std::size_t>(n)}, s.eof);
+                if (done > loop.now()) {
+                    loop.schedule(done, free);
+                }
+                moved = true;
+            }
+            return moved;
+        }
+
+        static bool deliver(pipe& rx, side& to)
+        {
+            bool moved = false;
+            while (!rx.received.empty()) {
+                auto n = ::send(to.fd, rx.received.data(), rx.received.size(), MSG_NOSIGNAL);
+                if (n < 0) {
+                    // the end was closed, what is left has no reader
+                    if (errno != EAGAIN && errno != EINTR) {
+                        rx.received.clear();
+                    }
+                    break;
+                }
+                rx.received.erase(0, n);
+                moved = true;
+            }
+            if (rx.eof && rx.received.empty() && !to.shut) {
+                to.shut = true;
+                ::shutdown(to.fd, SHUT_WR);
+                moved = true;
+            }
+            return moved;
+        }
+
+        bool pump() override
+        {
+            bool moved = false;
+            for (int i = 0; i < 2; ++i) {
+                moved |= send(sides[i]);
+                moved |= deliver(*sides[i].tx, sides[1 - i]);
+            }
+            return moved;
+        }
+
+    public:
+        explicit wire(const link& shape = {}) : loop{virtual_loop::current()}
+        {
+            for (int i = 0; i < 2; ++i) {
+                int fds[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0) {
+                    ends[i].open(fds[0]);
+                    sides[i].fd = fds[1];
+                }
+                sides[i].tx = std::make_shared<pipe>(loop, shape);
+            }
+            loop.attach(this);
+        }
+
+        wire(const wire&) = delete;
+        wire& operator=(const wire&) = delete;
+
+        ~wire()
+        {
+            loop.detach(this);
+            for (auto& s : sides) {
+                if (s.fd >= 0) {
+                    ::close(s.fd);
+                }
+            }
+        }
+
+        couv::pipe& client() noexcept { return ends[0]; }
+        couv::pipe& server() noexcept { return ends[1]; }
+    };
+}
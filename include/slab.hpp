@@ -0,0 +1,185 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace couv
+{
+    struct slab_stats
+    {
+        const char* type{nullptr};
+        std::size_t live{0};  // includes blocks other threads freed until the owner takes them back
+        std::size_t peak{0};
+        std::size_t capacity{0};
+    };
+
+    class slab_base
+    {
+        slab_base* next;
+
+        static slab_base*& registry() noexcept
+        {
+            static thread_local slab_base* head = nullptr;
+            return head;
+        }
+
+        template <typename F>
+        friend void for_each_slab(F f);
+
+    protected:
+        slab_stats counters;
+
+        slab_base(const char* type) noexcept : next{std::exchange(registry(), this)}
+        {
+            counters.type = type;
+        }
+
+    public:
+        const slab_stats& stats() const noexcept { return counters; }
+    };
+
+    // visits the slabs of the calling thread
+    template <typename F>
+    void for_each_slab(F f)
+    {
+        for (auto slab = slab_base::registry(); slab; slab = slab->next) {
+            f(slab->stats());
+        }
+    }
+
+    // fixed size free list per type and thread. A block freed on another thread, such as state a
+    // coroutine carried along with schedule_on, goes back to the slab that owns it through a
+    // lock-free return list, which the owner takes over when its free list runs dry. Blocks must
+    // be freed before the thread that allocated them exits
+    template <typename T, std::size_t N = 64>
+    class slab : public slab_base
+    {
+        struct slot
+        {
+            slab* owner;
+            union
+            {
+                slot* next;
+                alignas(T) std::byte storage[sizeof(T)];
+            };
+        };
+
+        slot* free{nullptr};
+        std::atomic<slot*> returned{nullptr};
+        std::vector<std::unique_ptr<slot[]>> chunks;
+
+        slab() : slab_base{typeid(T).name()} {}
+
+        static slot* slot_of(void* p) noexcept
+        {
+            return reinterpret_cast<slot*>(static_cast<std::byte*>(p) - offsetof(slot, storage));
+        }
+
+        void grow()
+        {
+            auto& chunk = chunks.emplace_back(new slot[N]);
+            for (std::size_t i = 0; i < N; ++i) {
+                chunk[i].owner = this;
+                chunk[i].next = free;
+                free = &chunk[i];
+            }
+            counters.capacity += N;
+        }
+
+        void reclaim() noexcept
+        {
+            auto s = returned.exchange(nullptr, std::memory_order_acquire);
+            while (s) {
+                auto next = s->next;
+                s->next = free;
+                free = s;
+                --counters.live;
+                s = next;
+            }
+        }
+
+        void give_back(slot* s) noexcept
+        {
+            s->next = returned.load(std::memory_order_relaxed);
+            while (!returned.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+
+    public:
+        slab(const slab&) = delete;
+
+        // blocks still pending close callbacks at thread exit are leaked rather than freed under them
+        ~slab()
+        {
+            reclaim();
+            if (counters.live) {
+                for (auto& chunk : chunks) {
+                    chunk.release();
+                }
+            }
+        }
+
+        static slab& local()
+        {
+            static thread_local slab instance;
+            return instance;
+        }
+
+        void* allocate()
+        {
+            [[unlikely]] if (!free) {
+                reclaim();
+                if (!free) {
+                    grow();
+                }
+            }
+            auto s = std::exchange(free, free->next);
+            counters.peak = std::max(counters.peak, ++counters.live);
+            return s->storage;
+        }
+
+        void deallocate(void* p) noexcept
+        {
+            auto s = slot_of(p);
+            [[unlikely]] if (s->owner != this) {
+                s->owner->give_back(s);
+                return;
+            }
+            s->next = free;
+            free = s;
+            --counters.live;
+        }
+    };
+
+    // state blocks derive from this to come from their thread's slab
+    template <typename T>
+    struct slab_allocated
+    {
+        static void* operator new(std::size_t size)
+        {
+            [[unlikely]] if (size != sizeof(T)) {
+                return ::operator new(size);
+            }
+            return slab<T>::local().allocate();
+        }
+
+        static void operator delete(void* p, std::size_t size) noexcept
+        {
+            [[unlikely]] if (size != sizeof(T)) {
+                return ::operator delete(p);
+            }
+            slab<T>::local().deallocate(p);
+        }
+    };
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace couv
+{
+    inline constexpr std::size_t cache_line_size = 64;
+
+    // wait-free single producer single consumer queue, N must be a power of two
+    template <typename T, std::size_t N = 256>
+    class spsc_ring
+    {
+        static_assert(N && (N & (N - 1)) == 0, "spsc_ring size must be a power of two");
+
+        alignas(cache_line_size) std::atomic<std::size_t> head{0};
+        std::size_t cached_tail{0};
+        alignas(cache_line_size) std::atomic<std::size_t> tail{0};
+        std::size_t cached_head{0};
+        alignas(cache_line_size) std::array<T, N> slots;
+
+    public:
+        template <typename U>
+        bool try_push(U&& u)
+        {
+            auto t = tail.load(std::memory_order_relaxed);
+            if (t - cached_head == N) {
+                cached_head = head.load(std::memory_order_acquire);
+                if (t - cached_head == N) {
+                    return false;
+                }
+            }
+            slots[t & (N - 1)] = std::forward<U>(u);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        std::optional<T> try_pop()
+        {
+            auto h = head.load(std::memory_order_relaxed);
+            if (h == cached_tail) {
+                cached_tail = tail.load(std::memory_order_acquire);
+                if (h == cached_tail) {
+                    return std::nullopt;
+                }
+            }
+            std::optional<T> out{std::move(slots[h & (N - 1)])};
+            head.store(h + 1, std::memory_order_release);
+            return out;
+        }
+
+        // consumer side
+        bool empty() const noexcept
+        {
+            return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+        }
+    };
+}
@@ -0,0 +1,516 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <type_traits>
+
+#include <scheduler.hpp>
+
+// coroutine mutex, semaphore, event and condition_variable. Waiters are nodes inside the awaiting
+// frame so nothing is allocated. The loop local versions resume waiters directly without nesting
+// one wake inside another, the thread_safe_ versions may be used from several loops and post each
+// waiter back to the loop it suspended on
+namespace couv
+{
+    namespace detail
+    {
+        struct no_lock
+        {
+            void lock() noexcept {}
+            void unlock() noexcept {}
+        };
+
+        struct waiter_list;
+
+        struct waiter : schedule_node
+        {
+            waiter* prev{nullptr};
+            waiter* next_waiter{nullptr};
+            waiter_list* list{nullptr};
+            event_loop* loop{nullptr};
+
+            waiter() = default;
+            waiter(const waiter&) = delete;
+            waiter& operator=(const waiter&) = delete;
+        };
+
+        struct waiter_list
+        {
+            waiter* head{nullptr};
+            waiter* tail{nullptr};
+
+            bool empty() const noexcept { return head == nullptr; }
+
+            void push_back(waiter* w) noexcept
+            {
+                w->list = this;
+                w->prev = tail;
+                w->next_waiter = nullptr;
+                (tail ? tail->next_waiter : head) = w;
+                tail = w;
+            }
+
+            void erase(waiter* w) noexcept
+            {
+                (w->prev ? w->prev->next_waiter : head) = w->next_waiter;
+                (w->next_waiter ? w->next_waiter->prev : tail) = w->prev;
+                w->prev = w->next_waiter = nullptr;
+                w->list = nullptr;
+            }
+
+            waiter* pop_front() noexcept
+            {
+                auto w = head;
+                erase(w);
+                return w;
+            }
+        };
+
+        // waiters handed what they waited for but not resumed yet
+        inline waiter_list& woken() noexcept
+        {
+            static thread_local waiter_list queue;
+            return queue;
+        }
+
+        // wakes inline, but a wake from inside a waiter already being woken on this thread is queued
+        // and run by the outer one, so a chain of handoffs keeps one frame on the stack
+        inline void resume_flat(waiter* w) noexcept
+        {
+            auto& queue = woken();
+            static thread_local bool running = false;
+            queue.push_back(w);
+            if (std::exchange(running, true)) {
+                return;
+            }
+            while (!queue.empty()) {
+                queue.pop_front()->co_handle();
+            }
+            running = false;
+        }
+
+        template <bool ThreadSafe>
+        class sync_base
+        {
+        protected:
+            mutable std::conditional_t<ThreadSafe, std::mutex, no_lock> state_lock;
+            waiter_list waiters;
+
+            void enqueue(waiter& w, std::coroutine_handle<> h) noexcept
+            {
+                w.co_handle = h;
+                if constexpr (ThreadSafe) {
+                    w.loop = &event_loop::current();
+                }
+                waiters.push_back(&w);
+            }
+
+            // true when w was already handed what it waited for and queued to be woken,
+            // the caller gives that back
+            bool cancel(waiter& w) noexcept
+            {
+                std::lock_guard guard{state_lock};
+                if (w.list == &waiters) {
+                    waiters.erase(&w);
+                } else if (w.list == &woken()) {
+                    w.list->erase(&w);
+                    return true;
+                }
+                return false;
+            }
+
+            // the coroutine to continue with, waiters of other loops are posted there instead
+            static std::coroutine_handle<> wake(waiter* w) noexcept
+            {
+                if constexpr (ThreadSafe) {
+                    w->loop->post(w);
+                    return std::noop_coroutine();
+                } else {
+                    return w->co_handle;
+                }
+            }
+
+            static void resume(waiter* w) noexcept
+            {
+                if constexpr (ThreadSafe) {
+                    w->loop->post(w);
+                } else {
+                    resume_flat(w);
+                }
+            }
+
+            // chain is linked through next_waiter, read before resuming as the node lives in the frame
+            static void wake_all(waiter* chain) noexcept
+            {
+                while (chain) {
+                    resume(std::exchange(chain, chain->next_waiter));
+                }
+            }
+
+            waiter* take_all() noexcept
+            {
+                waiter* chain = waiters.head;
+                for (auto w = chain; w; w = w->next_waiter) {
+                    w->list = nullptr;
+                }
+                waiters = {};
+                return chain;
+            }
+        };
+    }
+
+    template <bool ThreadSafe>
+    class basic_semaphore : detail::sync_base<ThreadSafe>
+    {
+        std::size_t count;
+
+        class acquire_awaiter : detail::waiter
+        {
+            basic_semaphore& sem;
+
+        public:
+            acquire_awaiter(basic_semaphore& sem) noexcept : sem{sem} {}
+
+            ~acquire_awaiter()
+            {
+                if (sem.cancel(*this)) {
+                    sem.release();
+                }
+            }
+
+            bool await_ready() noexcept { return sem.try_acquire(); }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                std::lock_guard guard{sem.state_lock};
+                if (sem.count) {
+                    --sem.count;
+                    return false;
+                }
+                sem.enqueue(*this, h);
+                return true;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        explicit basic_semaphore(std::size_t count) noexcept : count{count} {}
+
+        basic_semaphore(const basic_semaphore&) = delete;
+        basic_semaphore& operator=(const basic_semaphore&) = delete;
+
+        bool try_acquire() noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            if (count) {
+                --count;
+                return true;
+            }
+            return false;
+        }
+
+        // completes once a unit was handed over, waiters are served in order
+        acquire_awaiter acquire() noexcept { return {*this}; }
+
+        void release(std::size_t n = 1) noexcept
+        {
+            detail::waiter* chain = nullptr;
+            detail::waiter* last = nullptr;
+            {
+                std::lock_guard guard{this->state_lock};
+                for (; n && !this->waiters.empty(); --n) {
+                    auto w = this->waiters.pop_front();
+                    (last ? last->next_waiter : chain) = w;
+                    last = w;
+                }
+                count += n;
+            }
+            this->wake_all(chain);
+        }
+
+        std::size_t available() const noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            return count;
+        }
+    };
+
+    template <bool ThreadSafe>
+    class basic_condition_variable;
+
+    template <bool ThreadSafe>
+    class basic_mutex : detail::sync_base<ThreadSafe>
+    {
+        bool locked{false};
+
+        friend class basic_condition_variable<ThreadSafe>;
+
+        class lock_awaiter : detail::waiter
+        {
+        protected:
+            basic_mutex& m;
+
+        public:
+            lock_awaiter(basic_mutex& m) noexcept : m{m} {}
+
+            ~lock_awaiter()
+            {
+                if (m.cancel(*this)) {
+                    m.unlock();
+                }
+            }
+
+            bool await_ready() noexcept { return m.try_lock(); }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                std::lock_guard guard{m.state_lock};
+                if (!m.locked) {
+                    m.locked = true;
+                    return false;
+                }
+                m.enqueue(*this, h);
+                return true;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        // ownership passes straight to the next waiter, which the caller has to wake
+        detail::waiter* release() noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            if (this->waiters.empty()) {
+                locked = false;
+                return nullptr;
+            }
+            return this->waiters.pop_front();
+        }
+
+        // lock for a waiter moved over from a condition variable, false when it was queued instead
+        bool lock_or_enqueue(detail::waiter& w) noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            if (!locked) {
+                locked = true;
+                return true;
+            }
+            this->waiters.push_back(&w);
+            return false;
+        }
+
+    public:
+        class guard
+        {
+            basic_mutex* m;
+
+        public:
+            guard(basic_mutex& m) noexcept : m{&m} {}
+            guard(guard&& g) noexcept : m{std::exchange(g.m, nullptr)} {}
+
+            ~guard()
+            {
+                if (m) {
+                    m->unlock();
+                }
+            }
+        };
+
+        basic_mutex() = default;
+        basic_mutex(const basic_mutex&) = delete;
+        basic_mutex& operator=(const basic_mutex&) = delete;
+
+        bool try_lock() noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            return !std::exchange(locked, true);
+        }
+
+        lock_awaiter lock() noexcept { return {*this}; }
+
+        // unlocks when the returned guard goes out of scope
+        auto scoped_lock() noexcept
+        {
+            struct scoped_awaiter : lock_awaiter
+            {
+                using lock_awaiter::lock_awaiter;
+                guard await_resume() const noexcept { return {this->m}; }
+            };
+            return scoped_awaiter{*this};
+        }
+
+        void unlock() noexcept
+        {
+            if (auto next = release()) {
+                this->resume(next);
+            }
+        }
+    };
+
+    template <bool ThreadSafe>
+    class basic_event : detail::sync_base<ThreadSafe>
+    {
+        bool state;
+
+        class wait_awaiter : detail::waiter
+        {
+            basic_event& e;
+
+        public:
+            wait_awaiter(basic_event& e) noexcept : e{e} {}
+
+            ~wait_awaiter()
+            {
+                e.cancel(*this);
+            }
+
+            bool await_ready() const noexcept { return e.is_set(); }
+
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                std::lock_guard guard{e.state_lock};
+                if (e.state) {
+                    return false;
+                }
+                e.enqueue(*this, h);
+                return true;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        explicit basic_event(bool state = false) noexcept : state{state} {}
+
+        basic_event(const basic_event&) = delete;
+        basic_event& operator=(const basic_event&) = delete;
+
+        bool is_set() const noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            return state;
+        }
+
+        // wakes every waiter, later waits complete at once until reset
+        void set() noexcept
+        {
+            detail::waiter* chain;
+            {
+                std::lock_guard guard{this->state_lock};
+                state = true;
+                chain = this->take_all();
+            }
+            this->wake_all(chain);
+        }
+
+        void reset() noexcept
+        {
+            std::lock_guard guard{this->state_lock};
+            state = false;
+        }
+
+        wait_awaiter wait() noexcept { return {*this}; }
+        wait_awaiter operator co_await() noexcept { return {*this}; }
+    };
+
+    template <bool ThreadSafe>
+    class basic_condition_variable : detail::sync_base<ThreadSafe>
+    {
+        class wait_awaiter : detail::waiter
+        {
+            basic_condition_variable& cv;
+            basic_mutex<ThreadSafe>& m;
+
+            friend class basic_condition_variable;
+
+        public:
+            wait_awaiter(basic_condition_variable& cv, basic_mutex<ThreadSafe>& m) noexcept : cv{cv}, m{m} {}
+
+            ~wait_awaiter()
+            {
+                // queued to be woken from either list means it owned the mutex already
+                if (cv.cancel(*this) | m.cancel(*this)) {
+                    m.unlock();
+                }
+            }
+
+            bool await_ready() const noexcept { return false; }
+
+            // continues with the coroutine the mutex is handed to, without nesting resumptions
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                {
+                    std::lock_guard guard{cv.state_lock};
+                    cv.enqueue(*this, h);
+                }
+                if (auto next = m.release()) {
+                    return cv.wake(next);
+                }
+                return std::noop_coroutine();
+            }
+
+            // the mutex is held again
+            void await_resume() const noexcept {}
+        };
+
+        // the waiter queues on its mutex and runs once it owns it
+        void requeue(detail::waiter* chain) noexcept
+        {
+            while (chain) {
+                auto w = static_cast<wait_awaiter*>(std::exchange(chain, chain->next_waiter));
+                if (w->m.lock_or_enqueue(*w)) {
+                    this->resume(w);
+                }
+            }
+        }
+
+    public:
+        basic_condition_variable() = default;
+        basic_condition_variable(const basic_condition_variable&) = delete;
+        basic_condition_variable& operator=(const basic_condition_variable&) = delete;
+
+        // m must be locked, it is released while waiting and held again on resumption
+        wait_awaiter wait(basic_mutex<ThreadSafe>& m) noexcept { return {*this, m}; }
+
+        void notify_one() noexcept
+        {
+            detail::waiter* w = nullptr;
+            {
+                std::lock_guard guard{this->state_lock};
+                if (!this->waiters.empty()) {
+                    w = this->waiters.pop_front();
+                    w->next_waiter = nullptr;
+                }
+            }
+            requeue(w);
+        }
+
+        void notify_all() noexcept
+        {
+            detail::waiter* chain;
+            {
+                std::lock_guard guard{this->state_lock};
+                chain = this->take_all();
+            }
+            requeue(chain);
+        }
+    };
+
+    using mutex = basic_mutex<false>;
+    using semaphore = basic_semaphore<false>;
+    using event = basic_event<false>;
+    using condition_variable = basic_condition_variable<false>;
+
+    using thread_safe_mutex = basic_mutex<true>;
+    using thread_safe_semaphore = basic_semaphore<true>;
+    using thread_safe_event = basic_event<true>;
+    using thread_safe_condition_variable = basic_condition_variable<true>;
+}
@@ -7,24 +7,59 @@
 
 #include <coroutine>
 #include <iostream>
+#include <utility>
 #include <expect.hpp>
 
 namespace couv
 {
-    template <typename T>
+    template <typename T, typename E>
     class task;
 
-    template <typename T>
-    class task_promise
+    class task_group;
+
+    class task_promise_base
     {
-        expect<T> _value;
+    protected:
         std::coroutine_handle<> _continuation;
-        friend class task<T>;
+
+        // intrusive hook, set while the task is owned by a task_group
+        task_group* _group{nullptr};
+        task_promise_base* _prev{nullptr};
+        task_promise_base* _next{nullptr};
+        std::coroutine_handle<> _self;
+
+        friend class task_group;
+
+        bool _finished{false};
+
+        task_promise_base() : _continuation{std::noop_coroutine()} {}
+
+        std::coroutine_handle<> finish(std::coroutine_handle<> h) noexcept;
 
     public:
-        task_promise() : _continuation{std::noop_coroutine()}
+        bool finished() const noexcept { return _finished; }
+
+    protected:
+
+        struct final_awaiter
         {
-        }
+            bool await_ready() const noexcept { return false; }
+            template <typename P>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<P> ch) const noexcept { 
+                return ch.promise().finish(ch); 
+            }
+            void await_resume() const noexcept {}
+        };
+    };
+
+    template <typename T = void, typename E = std::exception_ptr>
+    class task_promise : public task_promise_base
+    {
+        expect<T, E> _value;
+        friend class task<T, E>;
+
+    public:
+        task_promise() = default;
 
         task_promise(const task_promise&) = delete;
         task_promise(task_promise&&) = default;
@@ -40,14 +75,8 @@ namespace couv
         std::suspend_never initial_suspend() { 
             return {}; 
         }
-        auto final_suspend() noexcept { 
-            struct final_awaiter
-            {
-                bool await_ready() const noexcept { return false; }
-                auto await_suspend(std::coroutine_handle<task_promise> ch) const noexcept { return ch.promise()._continuation; }
-                void await_resume() const noexcept {}
-            };
-            return final_awaiter{}; 
+        final_awaiter final_suspend() noexcept { 
+            return {}; 
         }
 
         template <typename U>
@@ -55,26 +84,35 @@ namespace couv
             _value = std::forward<U>(value);
         }
 
-        void return_value(const std::exception_ptr& value) { 
+        void return_value(const E& value) { 
             _value = value;
         }
 
-        void return_value(std::exception_ptr&& value) { 
+        void return_value(E&& value) { 
             _value = std::move(value);
         }
 
         void unhandled_exception() { 
-            _value = std::current_exception();
+            _value = current_error<E>();
+        }
+
+        using error_type = E;
+
+        // completes the task with an error from an await point, without unwinding
+        template <typename F>
+        std::coroutine_handle<> fail(std::coroutine_handle<> h, F&& error) noexcept {
+            _value = to_error<E>(std::forward<F>(error));
+            return finish(h);
         }
     };
 
-    template <class T = void>
+    template <typename T = void, typename E = std::exception_ptr>
     class task
     {
     public:
-        using promise_type = task_promise<T>;
+        using promise_type = task_promise<T, E>;
 
-        task(std::coroutine_handle<task_promise<T>> ch)
+        task(std::coroutine_handle<promise_type> ch)
             : _handle(ch)
         {
         }
@@ -108,36 +146,36 @@ namespace couv
 
         bool valid() const { return static_cast<bool>(_handle); }
 
-        const expect<T>& expected() const { return _handle.promise()._value; }
+        const expect<T, E>& expected() const { return _handle.promise()._value; }
 
         bool await_ready() const noexcept {
-            return _handle.done();
+            return _handle.promise().finished();
         }
         void await_suspend(std::coroutine_handle<> ch) noexcept { 
             _handle.promise()._continuation = ch; 
         }
 
-        const expect<T>& await_resume() const& noexcept { 
+        const expect<T, E>& await_resume() const& noexcept { 
             return _handle.promise()._value;
         }
 
-        expect<T>&& await_resume() && noexcept { 
+        expect<T, E>&& await_resume() && noexcept { 
             return std::move(_handle.promise()._value);
         }
 
     private:
-        std::coroutine_handle<task_promise<T>> _handle;
+        std::coroutine_handle<promise_type> _handle;
+        friend class task_group;
     };
 
-    template <>
-    class task_promise<void>
+    template <typename E>
+    class task_promise<void, E> : public task_promise_base
     {
-        expect<void> _value;
-        std::coroutine_handle<> _continuation;
-        friend class task<void>;
+        expect<void, E> _value;
+        friend class task<void, E>;
 
     public:
-        task_promise() : _continuation{std::noop_coroutine()} {}
+        task_promise() = default;
 
         task_promise(const task_promise&) = delete;
         task_promise(task_promise&&) = default;
@@ -153,34 +191,49 @@ namespace couv
         std::suspend_never initial_suspend() { 
             return {}; 
         }
-        auto final_suspend() noexcept { 
-            struct final_awaiter
-            {
-                bool await_ready() const noexcept { return false; }
-                auto await_suspend(std::coroutine_handle<task_promise> ch) const noexcept { return ch.promise()._continuation; }
-                void await_resume() const noexcept {}
-            };
-            return final_awaiter{}; 
+        final_awaiter final_suspend() noexcept { 
+            return {}; 
         }
 
-        void return_value(const std::exception_ptr& value) { 
+        // a falsy error such as error_code{0} completes the task successfully
+        void return_value(const E& value) { 
+            if constexpr (std::is_constructible_v<bool, const E&>) {
+                if (!value) {
+                    _value.emplace();
+                    return;
+                }
+            }
             _value = value;
         }
 
-        void return_value(std::exception_ptr&& value) { 
+        void return_value(E&& value) { 
+            if constexpr (std::is_constructible_v<bool, const E&>) {
+                if (!value) {
+                    _value.emplace();
+                    return;
+                }
+            }
             _value = std::move(value);
         }
 
         void unhandled_exception() noexcept {  
-            _value = std::current_exception();
+            _value = current_error<E>();
+        }
+
+        using error_type = E;
+
+        template <typename F>
+        std::coroutine_handle<> fail(std::coroutine_handle<> h, F&& error) noexcept {
+            _value = to_error<E>(std::forward<F>(error));
+            return finish(h);
         }
     };
 
-    template<>
-    class task<void>
+    template <typename E>
+    class task<void, E>
     {
     public:
-        using promise_type = task_promise<void>;
+        using promise_type = task_promise<void, E>;
 
         task(std::coroutine_handle<promise_type> ch)
             : _handle(ch)
@@ -215,16 +268,115 @@ namespace couv
 
         bool valid() const noexcept { return static_cast<bool>(_handle); }
 
-        const expect<>& expected() const noexcept { return _handle.promise()._value; }
+        const expect<void, E>& expected() const noexcept { return _handle.promise()._value; }
 
-        bool await_ready() const noexcept { return _handle.done(); }
+        bool await_ready() const noexcept { return _handle.promise().finished(); }
 
         void await_suspend(std::coroutine_handle<> ch) noexcept { _handle.promise()._continuation = ch; }
 
-        const expect<>& await_resume() const & noexcept { return _handle.promise()._value; }
-        expect<>&& await_resume() && noexcept { return std::move(_handle.promise()._value); }
+        const expect<void, E>& await_resume() const & noexcept { return _handle.promise()._value; }
+        expect<void, E>&& await_resume() && noexcept { return std::move(_handle.promise()._value); }
     
     private:
         std::coroutine_handle<promise_type> _handle;
+        friend class task_group;
     };  
+
+    // owns spawned tasks, frees each frame as soon as it finishes
+    // and destroys the ones still running when the group goes away
+    class task_group
+    {
+        task_promise_base* head{nullptr};
+        std::size_t count{0};
+        std::coroutine_handle<> joiner;
+
+        friend class task_promise_base;
+
+        std::coroutine_handle<> unlink(task_promise_base* p) noexcept
+        {
+            if (p->_prev) {
+                p->_prev->_next = p->_next;
+            } else {
+                head = p->_next;
+            }
+            if (p->_next) {
+                p->_next->_prev = p->_prev;
+            }
+            p->_group = nullptr;
+            if (--count == 0 && joiner) {
+                return std::exchange(joiner, nullptr);
+            }
+            return std::noop_coroutine();
+        }
+
+    public:
+        task_group() = default;
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+
+        ~task_group() 
+        {
+            joiner = nullptr;
+            cancel();
+        }
+
+        template <typename T, typename E>
+        void spawn(task<T, E>&& t)
+        {
+            auto h = std::exchange(t._handle, nullptr);
+            if (!h) {
+                return;
+            }
+            if (h.promise().finished()) {
+                h.destroy();
+                return;
+            }
+            auto& p = h.promise();
+            p._group = this;
+            p._self = h;
+            p._prev = nullptr;
+            p._next = head;
+            if (head) {
+                head->_prev = &p;
+            }
+            head = &p;
+            ++count;
+        }
+
+        void cancel() noexcept
+        {
+            std::coroutine_handle<> next = std::noop_coroutine();
+            while (head) {
+                auto self = head->_self;
+                next = unlink(head);
+                self.destroy();
+            }
+            next.resume();
+        }
+
+        std::size_t size() const noexcept { return count; }
+
+        auto join() noexcept
+        {
+            struct join_awaiter
+            {
+                task_group& group;
+                bool await_ready() const noexcept { return group.count == 0; }
+                void await_suspend(std::coroutine_handle<> h) noexcept { group.joiner = h; }
+                void await_resume() const noexcept {}
+            };
+            return join_awaiter{*this};
+        }
+    };
+
+    inline std::coroutine_handle<> task_promise_base::finish(std::coroutine_handle<> h) noexcept
+    {
+        _finished = true;
+        if (!_group) {
+            return _continuation;
+        }
+        auto next = _group->unlink(this);
+        h.destroy();
+        return next;
+    }
 }
\ No newline at end of file
@@ -8,37 +8,124 @@
 #include <coroutine>
 #include <iostream>
 #include <memory>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
 #include <reader.hpp>
 #include <writer.hpp>
 #include <listner.hpp>
 #include <connector.hpp>
 #include <expect.hpp>
+#include <tcp_options.hpp>
 
 namespace couv
 {
     class tcp
     {
         std::shared_ptr<uv_tcp_t> socket;
+        tcp_options defaults;
         friend class connector;
         friend class listner;
-        friend class reader;
+        template <typename BufferPolicy>
+        friend class basic_reader;
         friend class writer;
 
         struct tcp_deleter
         {
             void operator()(void* p) const {
-                uv_close(static_cast<uv_handle_t*>(p), [](uv_handle_t* req) {
+                close_handle(static_cast<uv_handle_t*>(p), [](uv_handle_t* req) {
                     delete reinterpret_cast<uv_tcp_t*>(req);
                 });
             }
         };
 
+        static error_code parse_address(const char* ip, int port, sockaddr_storage& addr) noexcept
+        {
+            if (std::strchr(ip, ':')) {
+                return uv_ip6_addr(ip, port, reinterpret_cast<sockaddr_in6*>(&addr));
+            }
+            return uv_ip4_addr(ip, port, reinterpret_cast<sockaddr_in*>(&addr));
+        }
+
+        static error_code set_option(int fd, int level, int name, int value) noexcept
+        {
+            if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+                return uv_translate_sys_error(errno);
+            }
+            return 0;
+        }
+
+        int fd() const noexcept
+        {
+            uv_os_fd_t fd;
+            if (uv_fileno(reinterpret_cast<uv_handle_t*>(socket.get()), &fd) != 0) {
+                return -1;
+            }
+            return fd;
+        }
+
+        // libuv creates the socket lazily in bind or connect, options that 
+        // must precede those calls need it to exist already
+        error_code open_socket(int family) noexcept
+        {
+            if (fd() >= 0) {
+                return 0;
+            }
+            int sock = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (sock < 0) {
+                return uv_translate_sys_error(errno);
+            }
+            error_code err = uv_tcp_open(socket.get(), sock);
+            if (err) {
+                ::close(sock);
+            }
+            return err;
+        }
+
+        error_code set_listen_options() noexcept
+        {
+            int sock = fd();
+#ifdef TCP_FASTOPEN
+            if (defaults.fastopen && *defaults.fastopen) {
+                if (auto err = set_option(sock, IPPROTO_TCP, TCP_FASTOPEN, *defaults.fastopen)) {
+                    return err;
+                }
+            }
+#endif
+#ifdef TCP_DEFER_ACCEPT
+            if (defaults.defer_accept) {
+                if (auto err = set_option(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, *defaults.defer_accept)) {
+                    return err;
+                }
+            }
+#endif
+            return 0;
+        }
+
+        error_code set_connect_options(const sockaddr* addr, const tcp_options& options) noexcept
+        {
+            if (auto err = open_socket(addr->sa_family)) {
+                return err;
+            }
+#ifdef TCP_FASTOPEN_CONNECT
+            if (options.fastopen && *options.fastopen) {
+                if (auto err = set_option(fd(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1)) {
+                    return err;
+                }
+            }
+#endif
+            return set_options(options);
+        }
+
     public:
         tcp() : socket{new uv_tcp_t, tcp_deleter{}}
         {
-            uv_tcp_init(uv_default_loop(), socket.get());
+            uv_tcp_init(current_loop(), socket.get());
         }
 
         tcp(const tcp&) = delete;
@@ -46,36 +133,150 @@ namespace couv
         tcp(tcp&&) = default;
         tcp& operator=(tcp&&) = default;
         
+        // the client inherits the listener options from the kernel, no extra syscalls
         error_code accept(tcp& client) noexcept
         {
+            client.defaults = defaults;
             return uv_accept(reinterpret_cast<uv_stream_t*>(socket.get()), 
                 reinterpret_cast<uv_stream_t*>(client.socket.get()));
         }
 
-        error_code bind(std::string ip, int port) noexcept
+        const tcp_options& options() const noexcept { return defaults; }
+
+        // the socket, or -1 before it is opened
+        int fileno() const noexcept { return fd(); }
+
+        // lets go of the handle, it closes once readers and queued writes are done with it.
+        // Only destruction and assignment are left for this tcp afterwards
+        void close() noexcept
+        {
+            socket.reset();
+        }
+
+        // half close once the queued writes went out
+        error_code shutdown() noexcept
+        {
+            auto req = new uv_shutdown_t;
+            error_code err = uv_shutdown(req, reinterpret_cast<uv_stream_t*>(socket.get()), 
+                [](uv_shutdown_t* req, int) {
+                    delete req;
+                });
+            if (err) {
+                delete req;
+            }
+            return err;
+        }
+
+        // applies the per socket options, the socket must be open
+        error_code set_options(const tcp_options& options) noexcept
+        {
+            int sock = fd();
+            if (sock < 0) {
+                return UV_EBADF;
+            }
+            if (options.nodelay) {
+                if (auto err = uv_tcp_nodelay(socket.get(), *options.nodelay)) {
+                    return err;
+                }
+            }
+            if (options.keepalive) {
+                if (auto err = uv_tcp_keepalive(socket.get(), *options.keepalive != 0, *options.keepalive)) {
+                    return err;
+                }
+            }
+            if (options.send_buffer) {
+                int size = *options.send_buffer;
+                if (auto err = uv_send_buffer_size(reinterpret_cast<uv_handle_t*>(socket.get()), &size)) {
+                    return err;
+                }
+            }
+            if (options.recv_buffer) {
+                int size = *options.recv_buffer;
+                if (auto err = uv_recv_buffer_size(reinterpret_cast<uv_handle_t*>(socket.get()), &size)) {
+                    return err;
+                }
+            }
+#ifdef SO_BUSY_POLL
+            if (options.busy_poll) {
+                if (auto err = set_option(sock, SOL_SOCKET, SO_BUSY_POLL, *options.busy_poll)) {
+                    return err;
+                }
+            }
+#endif
+            return 0;
+        }
+
+        error_code open(uv_os_sock_t sock) noexcept
         {
-            struct sockaddr_in bind_addr;
-            uv_ip4_addr(ip.c_str(), port, &bind_addr);
+            return uv_tcp_open(socket.get(), sock);
+        }
+
+        // gives up the handle and returns a duplicate of its socket, 
+        // which can be opened by a tcp on another loop, -1 on failure
+        uv_os_sock_t detach() noexcept
+        {
+            uv_os_fd_t fd;
+            if (uv_fileno(reinterpret_cast<uv_handle_t*>(socket.get()), &fd) != 0) {
+                return -1;
+            }
+            uv_os_sock_t sock = dup(fd);
+            socket.reset();
+            return sock;
+        }
+
+        // accepts IPv4 and IPv6 addresses, options become the defaults of accepted sockets
+        error_code bind(std::string ip, int port, const tcp_options& options = {}) noexcept
+        {
+            struct sockaddr_storage bind_addr;
+            if (auto err = parse_address(ip.c_str(), port, bind_addr)) {
+                return err;
+            }
+            if (auto err = open_socket(bind_addr.ss_family)) {
+                return err;
+            }
+            defaults = options;
+            if (auto err = set_options(options)) {
+                return err;
+            }
             
-            return uv_tcp_bind(socket.get(), reinterpret_cast<sockaddr*>(&bind_addr), 0);
+            return uv_tcp_bind(socket.get(), reinterpret_cast<sockaddr*>(&bind_addr), 
+                options.ipv6_only ? UV_TCP_IPV6ONLY : 0);
         }
 
         listner listen(int backlog)
         {
+            if (auto err = set_listen_options()) {
+                return listner{err};
+            }
             return listner{*this, backlog};
         }
 
-        connector connect(const char* ip, int port) {
-            return connector{*this, ip, port};
+        connector connect(const char* ip, int port, const tcp_options& options = {}) {
+            struct sockaddr_storage addr;
+            if (auto err = parse_address(ip, port, addr)) {
+                return connector{err};
+            }
+            if (auto err = set_connect_options(reinterpret_cast<sockaddr*>(&addr), options)) {
+                return connector{err};
+            }
+            return connector{*this, reinterpret_cast<sockaddr*>(&addr)};
         }
 
-        connector connect(const getaddrinfo& info) {
-            return connector{*this, info};
+        connector connect(const getaddrinfo& info, const tcp_options& options = {}) {
+            auto addr = info.address();
+            if (!addr) {
+                return connector{UV_EINVAL};
+            }
+            if (auto err = set_connect_options(addr, options)) {
+                return connector{err};
+            }
+            return connector{*this, addr};
         }
 
 
-        reader read() {
-            reader r{*this};
+        template <typename BufferPolicy = shared_buffer>
+        basic_reader<BufferPolicy> read(BufferPolicy policy = {}) {
+            basic_reader<BufferPolicy> r{*this, std::move(policy)};
             r.start();
             return r;
         }
@@ -86,39 +287,25 @@ namespace couv
             w.write(std::move(data));
             return w;
         }
-    };
-
-    connector::connector(const tcp& tcp, const char* ip, int port) : 
-        data{std::make_unique<connector_data>()}
-    {
-        data->req.data = data.get();
-        struct sockaddr_in client_addr;
-        uv_ip4_addr(ip, port, &client_addr);
-
-        data->status = uv_tcp_connect(&data->req, tcp.socket.get(), reinterpret_cast<sockaddr*>(&client_addr),
-            [](uv_connect_t* req, int status) {
-                auto* data = static_cast<connector_data*>(req->data);
-                data->status = status;
-                [[likely]] if (data->co_handle) {
-                    data->co_handle();
-                }
-            });
 
-        if (data->status == 0) {
-            data->status = 1;
+        writer write(buffer_chain chain)
+        {
+            writer w{*this};
+            w.write(std::move(chain));
+            return w;
         }
-    }
+    };
 
-    connector::connector(const tcp& tcp, const getaddrinfo& info) : 
+    connector::connector(const tcp& tcp, const sockaddr* addr) : 
         data{std::make_unique<connector_data>()}
     {
         data->req.data = data.get();
-        data->status = uv_tcp_connect(&data->req, tcp.socket.get(), (const struct sockaddr*)info.data->getaddrinfo_handle.addrinfo->ai_addr,
+        data->status = uv_tcp_connect(&data->req, tcp.socket.get(), addr,
             [](uv_connect_t* req, int status) {
                 auto* data = static_cast<connector_data*>(req->data);
                 data->status = status;
                 [[likely]] if (data->co_handle) {
-                    data->co_handle();
+                    data->node.resume(req->handle->loop, std::exchange(data->co_handle, nullptr));
                 }
             });
 
@@ -137,18 +324,22 @@ namespace couv
             self->status = status;
             self->ready = true;
             if (self->co_handle)
-                self->co_handle();
+                self->node.resume(req->loop, std::exchange(self->co_handle, nullptr));
         });
     }
 
-    reader::reader(const tcp& tcp) : stream{std::reinterpret_pointer_cast<uv_stream_t>(tcp.socket)}
+    template <typename BufferPolicy>
+    basic_reader<BufferPolicy>::basic_reader(const tcp& tcp, BufferPolicy policy) : 
+        stream{std::reinterpret_pointer_cast<uv_stream_t>(tcp.socket)},
+        policy{std::move(policy)}
     {
         stream->data = this;
     }
 
     writer::writer(const tcp& tcp) : 
-        data{new writer_data{std::reinterpret_pointer_cast<uv_stream_t>(tcp.socket)}} 
+        data{new writer_data{}}
     {
+        data->stream = std::reinterpret_pointer_cast<uv_stream_t>(tcp.socket);
         data->write_handle.data = data.get();
     }
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <optional>
+
+namespace couv
+{
+    // unset fields keep the system default. Options set before listen are inherited 
+    // by accepted sockets in the kernel, so accepting applies nothing again
+    struct tcp_options
+    {
+        std::optional<bool> nodelay{};
+        std::optional<unsigned> keepalive{};    // idle seconds before probing, 0 disables
+        std::optional<int> send_buffer{};       // SO_SNDBUF bytes
+        std::optional<int> recv_buffer{};       // SO_RCVBUF bytes
+        std::optional<int> busy_poll{};         // SO_BUSY_POLL microseconds
+        std::optional<int> fastopen{};          // listen: TFO queue length, connect: enabled if non zero
+        std::optional<int> defer_accept{};      // TCP_DEFER_ACCEPT seconds, listen only
+        bool ipv6_only{false};                  // IPv6 binds are dual stack unless set
+    };
+}
@@ -0,0 +1,46 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+#include <uv.h> // libuv
+
+namespace couv
+{
+    // count is the number of ticks collapsed into one resumption, so count - 1 were dropped
+    // while the coroutine was busy or, for a repeating timer, while the loop was blocked
+    struct tick
+    {
+        int count;
+        uint64_t now;
+    };
+
+    template <typename Data>
+    class tick_awaiter
+    {
+        Data& data;
+        uv_loop_t* loop;
+
+    public:
+        tick_awaiter(Data& data, uv_loop_t* loop) noexcept : data{data}, loop{loop} {}
+
+        bool await_ready() const noexcept { 
+            return data.ready; 
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            data.co_handle = h;
+        }
+
+        tick await_resume() noexcept {
+            data.co_handle = nullptr;
+            return {std::exchange(data.ready, 0), uv_now(loop)};
+        }
+    };
+}
@@ -8,23 +8,30 @@
 #include <coroutine>
 #include <memory>
 #include <error_code.hpp>
+#include <tick.hpp>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
+#include <scheduler.hpp>
+#include <slab.hpp>
 
 namespace couv
 {
     class timer
     {
-        struct timer_data {
+        struct timer_data : slab_allocated<timer_data> {
             uv_timer_t timer_handle;
             std::coroutine_handle<> co_handle;
+            ready_node node;
+            uint64_t due{0};
             int ready{0};
         };
 
         struct timer_deleter
         {
             void operator()(timer_data* data) const noexcept {
-                uv_close(reinterpret_cast<uv_handle_t*>(&data->timer_handle), [](uv_handle_t* timer_handle) {
+                data->node.cancel();
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->timer_handle), [](uv_handle_t* timer_handle) {
                     delete static_cast<timer_data*>(timer_handle->data);
                 });
             }
@@ -35,29 +42,36 @@ namespace couv
     public:
         timer() : data{new timer_data{}, timer_deleter{}}
         {
-            uv_timer_init(uv_default_loop(), &data->timer_handle);
+            uv_timer_init(current_loop(), &data->timer_handle);
             data->timer_handle.data = data.get();
         }
 
         timer(uint64_t  timeout, uint64_t repeat = 0) 
             : data{new timer_data{}, timer_deleter{}}
         {
-            uv_timer_init(uv_default_loop(), &data->timer_handle);
+            uv_timer_init(current_loop(), &data->timer_handle);
             data->timer_handle.data = data.get();
             start(timeout, repeat);
         }
 
         error_code start(uint64_t  timeout, uint64_t repeat = 0) noexcept {
+            data->due = uv_now(data->timer_handle.loop) + timeout;
             return uv_timer_start(&data->timer_handle, [](uv_timer_t* timer_handle) {
                 auto data = static_cast<timer_data*>(timer_handle->data);
-                ++data->ready;
+                // libuv fires a repeating timer once however long the loop was blocked and
+                // schedules the next fire from now, the periods in between still count as ticks
+                uint64_t now = uv_now(timer_handle->loop);
+                uint64_t repeat = uv_timer_get_repeat(timer_handle);
+                data->ready += 1 + (repeat && now > data->due ? static_cast<int>((now - data->due) / repeat) : 0);
+                data->due = now + repeat;
                 if (data->co_handle) {
-                    data->co_handle();
+                    data->node.resume(timer_handle->loop, std::exchange(data->co_handle, nullptr));
                 }
             }, timeout, repeat);
         }
 
         error_code again() noexcept {
+            data->due = uv_now(data->timer_handle.loop) + uv_timer_get_repeat(&data->timer_handle);
             return uv_timer_again(&data->timer_handle);
         }
 
@@ -81,6 +95,24 @@ namespace couv
             data->co_handle = nullptr;
             --data->ready; 
         };
+
+        tick_awaiter<timer_data> ticks() noexcept {
+            return {*data, data->timer_handle.loop};
+        }
+    };
+
+    class ticker : private timer
+    {
+    public:
+        ticker(uint64_t interval) : timer{interval, interval} {}
+
+        using timer::again;
+        using timer::set_repeat;
+        using timer::stop;
+
+        auto operator co_await() noexcept {
+            return ticks();
+        }
     };
 
 };
\ No newline at end of file
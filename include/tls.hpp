@@ -0,0 +1,242 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h> // link with ssl and crypto
+
+#include <uv.h> // libuv
+#include <tcp.hpp>
+#include <task.hpp>
+#include <work.hpp>
+#include <error_code.hpp>
+
+namespace couv
+{
+    using tls_session = std::shared_ptr<SSL_SESSION>;
+
+    class tls_context
+    {
+        std::shared_ptr<SSL_CTX> ctx;
+        bool server;
+
+    public:
+        enum mode { client_mode, server_mode };
+
+        tls_context(mode m) :
+            ctx{SSL_CTX_new(m == server_mode ? TLS_server_method() : TLS_client_method()), SSL_CTX_free},
+            server{m == server_mode}
+        {
+            SSL_CTX_set_min_proto_version(ctx.get(), TLS1_2_VERSION);
+            SSL_CTX_set_mode(ctx.get(), SSL_MODE_RELEASE_BUFFERS);
+            if (server) {
+                SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_SERVER);
+            } else {
+                SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_CLIENT);
+                SSL_CTX_set_verify(ctx.get(), SSL_VERIFY_PEER, nullptr);
+                SSL_CTX_set_default_verify_paths(ctx.get());
+            }
+        }
+
+        SSL_CTX* get() const noexcept { return ctx.get(); }
+        bool is_server() const noexcept { return server; }
+
+        error_code use_certificate(X509* cert, EVP_PKEY* key) noexcept
+        {
+            if (SSL_CTX_use_certificate(ctx.get(), cert) != 1 ||
+                SSL_CTX_use_PrivateKey(ctx.get(), key) != 1) {
+                return UV_EINVAL;
+            }
+            return 0;
+        }
+
+        error_code use_certificate_file(const char* cert_file, const char* key_file) noexcept
+        {
+            if (SSL_CTX_use_certificate_chain_file(ctx.get(), cert_file) != 1 ||
+                SSL_CTX_use_PrivateKey_file(ctx.get(), key_file, SSL_FILETYPE_PEM) != 1) {
+                return UV_EINVAL;
+            }
+            return 0;
+        }
+
+        error_code trust(X509* cert) noexcept
+        {
+            if (X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx.get()), cert) != 1) {
+                return UV_EINVAL;
+            }
+            return 0;
+        }
+
+        void set_verify(bool verify) noexcept
+        {
+            SSL_CTX_set_verify(ctx.get(), verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
+        }
+    };
+
+    class tls_stream
+    {
+        tcp socket;
+        reader rd;
+        std::unique_ptr<SSL, decltype(&SSL_free)> ssl;
+        BIO* rbio;
+        BIO* wbio;
+
+        static error_code tls_error(int err) noexcept
+        {
+            ERR_clear_error();
+            return err == SSL_ERROR_ZERO_RETURN ? UV_EOF : UV_EPROTO;
+        }
+
+        // feeds one received chunk to openssl, the receive buffer is free again afterwards
+        task<void, error_code> fill()
+        {
+            auto data = co_await rd;
+            if (!data) {
+                co_return rd.error() ? rd.error() : error_code{UV_EOF};
+            }
+            BIO_write(rbio, data, static_cast<int>(rd.size()));
+            co_return error_code{0};
+        }
+
+        static work<int, error_code> handshake_step(SSL* ssl)
+        {
+            int ret = SSL_do_handshake(ssl);
+            co_return ret == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl, ret);
+        }
+
+    public:
+        tls_stream(tcp&& s, const tls_context& ctx) :
+            socket{std::move(s)},
+            rd{socket.read()},
+            ssl{SSL_new(ctx.get()), SSL_free},
+            rbio{BIO_new(BIO_s_mem())},
+            wbio{BIO_new(BIO_s_mem())}
+        {
+            BIO_set_mem_eof_return(rbio, -1);
+            SSL_set_bio(ssl.get(), rbio, wbio);
+            if (ctx.is_server()) {
+                SSL_set_accept_state(ssl.get());
+            } else {
+                SSL_set_connect_state(ssl.get());
+            }
+        }
+
+        tls_stream(tls_stream&&) = default;
+
+        SSL* native_handle() const noexcept { return ssl.get(); }
+        tcp& lowest_layer() noexcept { return socket; }
+
+        // server name for SNI and certificate verification, client side only
+        error_code set_hostname(const char* host) noexcept
+        {
+            if (SSL_set_tlsext_host_name(ssl.get(), host) != 1 || SSL_set1_host(ssl.get(), host) != 1) {
+                return UV_EINVAL;
+            }
+            return 0;
+        }
+
+        // resumes a previous session on the next handshake, client side only
+        error_code set_session(const tls_session& session) noexcept
+        {
+            if (SSL_set_session(ssl.get(), session.get()) != 1) {
+                return UV_EINVAL;
+            }
+            return 0;
+        }
+
+        // with TLS 1.3 tickets arrive after the handshake, so this is only set once data has been read
+        tls_session session() const
+        {
+            return {SSL_get1_session(ssl.get()), SSL_SESSION_free};
+        }
+
+        bool resumed() const noexcept { return SSL_session_reused(ssl.get()); }
+
+        // offload moves the expensive key exchange steps to the thread pool
+        task<void, error_code> handshake(bool offload = false)
+        {
+            while (true) {
+                int err = offload ?
+                    co_await co_await handshake_step(ssl.get()) :
+                    SSL_get_error(ssl.get(), SSL_do_handshake(ssl.get()));
+
+                if (BIO_ctrl_pending(wbio)) {
+                    co_await co_await flush();
+                }
+                if (err == SSL_ERROR_NONE) {
+                    co_return error_code{0};
+                }
+                if (err != SSL_ERROR_WANT_READ) {
+                    co_return tls_error(err);
+                }
+                co_await co_await fill();
+            }
+        }
+
+        // decrypts in place into the receive buffer, 
+        // the view is valid until the coroutine suspends again
+        task<std::string_view, error_code> read()
+        {
+            if (rd.buffer().empty()) {
+                co_await co_await fill();
+            }
+            while (true) {
+                auto buf = rd.buffer();
+                int n = SSL_read(ssl.get(), buf.data(), static_cast<int>(buf.size()));
+                if (n > 0) {
+                    co_return std::string_view{buf.data(), static_cast<std::size_t>(n)};
+                }
+
+                int err = SSL_get_error(ssl.get(), n);
+                if (BIO_ctrl_pending(wbio)) {
+                    co_await co_await flush();
+                }
+                if (err != SSL_ERROR_WANT_READ) {
+                    co_return tls_error(err);
+                }
+                co_await co_await fill();
+            }
+        }
+
+        // encrypts without sending, records of several queued writes go out in the next flush
+        error_code queue(std::string_view data) noexcept
+        {
+            if (data.empty()) {
+                return 0;
+            }
+            int n = SSL_write(ssl.get(), data.data(), static_cast<int>(data.size()));
+            if (n <= 0) {
+                return tls_error(SSL_get_error(ssl.get(), n));
+            }
+            return 0;
+        }
+
+        writer flush()
+        {
+            std::string out(BIO_ctrl_pending(wbio), '\0');
+            BIO_read(wbio, out.data(), static_cast<int>(out.size()));
+            return socket.write(std::move(out));
+        }
+
+        writer write(std::string_view data)
+        {
+            if (auto err = queue(data)) {
+                return writer{err};
+            }
+            return flush();
+        }
+
+        writer shutdown()
+        {
+            SSL_shutdown(ssl.get());
+            return flush();
+        }
+    };
+}
@@ -13,10 +13,21 @@
 #include <expect.hpp>
 
 #include <uv.h> // libuv
+#include <loop.hpp>
 
 namespace couv
 {
-    template <class T = void>
+    // error held by a work that never got to run, e.g. cancelled before a pool thread picked it up
+    template <typename E>
+    E unfinished_work_error() noexcept
+    {
+        if constexpr (std::is_same_v<std::exception_ptr, E>)
+            return nullptr;
+        else
+            return E(UV_ECANCELED);
+    }
+
+    template <class T = void, class E = std::exception_ptr>
     class work
     {
     public:
@@ -25,10 +36,10 @@ namespace couv
             uv_work_t work_handle;
             std::coroutine_handle<> continuation;
             std::coroutine_handle<> thread_pool_continuation;
-            expect<T> value;
+            expect<T, E> value;
             bool ready{false};
 
-            promise_type() : continuation{std::noop_coroutine()}, value(std::in_place, nullptr) {}
+            promise_type() : continuation{std::noop_coroutine()}, value(std::in_place, unfinished_work_error<E>()) {}
 
             ~promise_type() {
                 uv_cancel(reinterpret_cast<uv_req_t*>(&work_handle));
@@ -37,7 +48,7 @@ namespace couv
             promise_type(const promise_type&) = delete;
             promise_type(promise_type&&) = default;
 
-            work<T> get_return_object() noexcept
+            work<T, E> get_return_object() noexcept
             {
                 return std::coroutine_handle<promise_type>::from_promise(*this);
             }
@@ -50,7 +61,7 @@ namespace couv
                     void await_suspend(std::coroutine_handle<> h) noexcept {
                         promise->work_handle.data = promise;
                         promise->thread_pool_continuation = h;
-                        uv_queue_work(uv_default_loop(), &promise->work_handle, 
+                        uv_queue_work(current_loop(), &promise->work_handle, 
                         [](uv_work_t *work_handle){
                             auto self = static_cast<promise_type*>(work_handle->data);
                             self->thread_pool_continuation();
@@ -80,7 +91,17 @@ namespace couv
 
             void unhandled_exception() noexcept
             { 
-                value = std::current_exception();
+                value = current_error<E>();
+            }
+
+            using error_type = E;
+
+            // the pool thread returns to libuv, which then completes the work on the loop
+            template <typename F>
+            std::coroutine_handle<> fail(std::coroutine_handle<>, F&& error) noexcept
+            {
+                value = to_error<E>(std::forward<F>(error));
+                return std::noop_coroutine();
             }
         };
     
@@ -116,15 +137,15 @@ namespace couv
             _handle.promise().continuation = ch; 
         }
         
-        const expect<T>& await_resume() const& noexcept { return _handle.promise().value; }
-        expect<T>&& await_resume() && noexcept { return std::move(_handle.promise().value); }
+        const expect<T, E>& await_resume() const& noexcept { return _handle.promise().value; }
+        expect<T, E>&& await_resume() && noexcept { return std::move(_handle.promise().value); }
 
     private:
         std::coroutine_handle<promise_type> _handle;
     };
 
-    template<>
-    class work<void>
+    template <class E>
+    class work<void, E>
     {
     public:
         struct promise_type
@@ -132,7 +153,7 @@ namespace couv
             uv_work_t work_handle;
             std::coroutine_handle<> continuation;
             std::coroutine_handle<> thread_pool_continuation;
-            expect<void> value;
+            expect<void, E> value;
             bool ready{false};
             
             promise_type() : continuation{std::noop_coroutine()} {}
@@ -144,7 +165,7 @@ namespace couv
             promise_type(const promise_type&) = delete;
             promise_type(promise_type&&) = default;
 
-            work<void> get_return_object() noexcept
+            work<void, E> get_return_object() noexcept
             {
                 return std::coroutine_handle<promise_type>::from_promise(*this);
             }
@@ -157,7 +178,7 @@ namespace couv
                     void await_suspend(std::coroutine_handle<> h) const noexcept {
                         promise->work_handle.data = promise;
                         promise->thread_pool_continuation = h;
-                        uv_queue_work(uv_default_loop(), &promise->work_handle, 
+                        uv_queue_work(current_loop(), &promise->work_handle, 
                         [](uv_work_t *work_handle){
                             auto self = static_cast<promise_type*>(work_handle->data);
                             self->thread_pool_continuation();
@@ -180,7 +201,16 @@ namespace couv
             }
 
             void return_void() noexcept { }         
-            void unhandled_exception() noexcept { value = std::current_exception(); }
+            void unhandled_exception() noexcept { value = current_error<E>(); }
+
+            using error_type = E;
+
+            template <typename F>
+            std::coroutine_handle<> fail(std::coroutine_handle<>, F&& error) noexcept
+            {
+                value = to_error<E>(std::forward<F>(error));
+                return std::noop_coroutine();
+            }
         };
     
     
@@ -215,8 +245,8 @@ namespace couv
             _handle.promise().continuation = ch; 
         }
 
-        const expect<void>& await_resume() const& noexcept { return _handle.promise().value; }
-        expect<void>&& await_resume() && noexcept { return std::move(_handle.promise().value); }
+        const expect<void, E>& await_resume() const& noexcept { return _handle.promise().value; }
+        expect<void, E>&& await_resume() && noexcept { return std::move(_handle.promise().value); }
 
     private:
         std::coroutine_handle<promise_type> _handle;
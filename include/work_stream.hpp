@@ -0,0 +1,227 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <expect.hpp>
+#include <spsc_ring.hpp>
+#include <work.hpp>
+
+#include <uv.h> // libuv
+#include <loop.hpp>
+
+namespace couv
+{
+    template <class T, class E>
+    struct work_stream_result
+    {
+        expect<T, E> value;
+
+        work_stream_result() : value(std::in_place, unfinished_work_error<E>()) {}
+
+        template <typename U>
+        void return_value(U&& v)
+        {
+            value = std::forward<U>(v);
+        }
+    };
+
+    template <class E>
+    struct work_stream_result<void, E>
+    {
+        expect<void, E> value;
+
+        void return_void() noexcept {}
+    };
+
+    // thread pool work that streams progress values back to the loop with co_yield
+    template <class T, class P, class E = std::exception_ptr, std::size_t N = 256>
+    class work_stream
+    {
+        struct stream_data
+        {
+            uv_async_t async_handle;
+            std::coroutine_handle<> co_handle;
+            std::atomic<bool> signalled{false};
+            bool finished{false};
+            spsc_ring<P, N> ring;
+        };
+
+        struct stream_deleter
+        {
+            void operator()(stream_data* data) const noexcept {
+                close_handle(reinterpret_cast<uv_handle_t*>(&data->async_handle), [](uv_handle_t* async_handle) {
+                    delete static_cast<stream_data*>(async_handle->data);
+                });
+            }
+        };
+
+        static void wake(stream_data* data) noexcept
+        {
+            [[likely]] if (data->co_handle) {
+                std::exchange(data->co_handle, nullptr)();
+            }
+        }
+
+    public:
+        struct promise_type : work_stream_result<T, E>
+        {
+            uv_work_t work_handle;
+            std::coroutine_handle<> continuation;
+            std::coroutine_handle<> thread_pool_continuation;
+            std::unique_ptr<stream_data, stream_deleter> data;
+            bool ready{false};
+
+            promise_type() : continuation{std::noop_coroutine()}, data{new stream_data, stream_deleter{}}
+            {
+                data->async_handle.data = data.get();
+                uv_async_init(current_loop(), &data->async_handle, [](uv_async_t* async_handle) {
+                    auto data = static_cast<stream_data*>(async_handle->data);
+                    // cleared before draining, so a value pushed from now on signals again
+                    data->signalled.exchange(false, std::memory_order_acq_rel);
+                    // the waiter may already have taken what was signalled
+                    if (!data->ring.empty()) {
+                        wake(data);
+                    }
+                });
+            }
+
+            ~promise_type() {
+                uv_cancel(reinterpret_cast<uv_req_t*>(&work_handle));
+            }
+
+            promise_type(const promise_type&) = delete;
+
+            work_stream get_return_object() noexcept
+            {
+                return std::coroutine_handle<promise_type>::from_promise(*this);
+            }
+
+            auto initial_suspend() noexcept {
+                struct awaitable
+                {
+                    promise_type* promise;
+                    bool await_ready() const noexcept { return false; }
+                    void await_suspend(std::coroutine_handle<> h) noexcept {
+                        promise->work_handle.data = promise;
+                        promise->thread_pool_continuation = h;
+                        uv_queue_work(current_loop(), &promise->work_handle,
+                        [](uv_work_t *work_handle){
+                            auto self = static_cast<promise_type*>(work_handle->data);
+                            self->thread_pool_continuation();
+                        },
+                        [](uv_work_t *work_handle, int status){
+                            if (status != UV_ECANCELED) {
+                                auto self = static_cast<promise_type*>(work_handle->data);
+                                self->ready = true;
+                                self->data->finished = true;
+                                // either resumption may destroy the stream, so read both first
+                                auto continuation = self->continuation;
+                                auto progress_handle = std::exchange(self->data->co_handle, nullptr);
+                                if (progress_handle) {
+                                    progress_handle();
+                                }
+                                continuation();
+                            }
+                        });
+                    }
+                    void await_resume() const noexcept {};
+                };
+                return awaitable{this};
+            }
+
+            std::suspend_always final_suspend() noexcept {
+                return {};
+            }
+
+            // blocks the pool thread while the ring is full, the loop wakes at most once per drain
+            template <typename U>
+            std::suspend_never yield_value(U&& u)
+            {
+                while (!data->ring.try_push(std::forward<U>(u))) {
+                    std::this_thread::yield();
+                }
+                if (!data->signalled.exchange(true, std::memory_order_acq_rel)) {
+                    uv_async_send(&data->async_handle);
+                }
+                return {};
+            }
+
+            void unhandled_exception() noexcept
+            {
+                this->value = current_error<E>();
+            }
+
+            using error_type = E;
+
+            template <typename F>
+            std::coroutine_handle<> fail(std::coroutine_handle<>, F&& error) noexcept
+            {
+                this->value = to_error<E>(std::forward<F>(error));
+                return std::noop_coroutine();
+            }
+        };
+
+        work_stream(std::coroutine_handle<promise_type> ch)
+            : _handle(ch)
+        {}
+
+        work_stream(const work_stream&) = delete;
+
+        work_stream(work_stream&& f) : _handle(std::move(f._handle)) {
+            f._handle = nullptr;
+        }
+
+        ~work_stream()
+        {
+            if (_handle) {
+                _handle.destroy();
+            }
+        }
+
+        // next progress value, nullopt once the work finished and everything was drained
+        auto progress() noexcept
+        {
+            struct progress_awaiter
+            {
+                stream_data* data;
+                std::optional<P> value{};
+
+                bool await_ready() {
+                    value = data->ring.try_pop();
+                    return value || data->finished;
+                }
+                void await_suspend(std::coroutine_handle<> h) noexcept {
+                    data->co_handle = h;
+                }
+                std::optional<P> await_resume() {
+                    if (!value) {
+                        value = data->ring.try_pop();
+                    }
+                    return std::move(value);
+                }
+            };
+            return progress_awaiter{_handle.promise().data.get()};
+        }
+
+        bool await_ready() const {
+             return  _handle.promise().ready;
+        }
+        void await_suspend(std::coroutine_handle<> ch) const {
+            _handle.promise().continuation = ch;
+        }
+
+        const expect<T, E>& await_resume() const& noexcept { return _handle.promise().value; }
+        expect<T, E>&& await_resume() && noexcept { return std::move(_handle.promise().value); }
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+    };
+}
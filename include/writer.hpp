@@ -6,45 +6,131 @@
 #pragma once
 
 #include <coroutine>
+#include <cstdint>
+#include <iterator>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 #include <error_code.hpp>
+#include <buffer_chain.hpp>
 
 #include <uv.h> // libuv
+#include <scheduler.hpp>
+#include <slab.hpp>
 
 namespace couv
 {
     class tcp;
+    class pipe;
     class writer
     {
-        struct writer_data {
+        struct writer_data : slab_allocated<writer_data> {
             std::shared_ptr<uv_stream_t> stream;
             uv_write_t write_handle;
             std::string to_write;
+            buffer_chain chain;
             std::coroutine_handle<> co_handle;
+            ready_node node;
             int status{0};
         };
 
         std::unique_ptr<writer_data> data;
 
+        // bytes a thread may complete inline per millisecond of loop time. Past that writes take
+        // the callback, so a writer that keeps the socket busy still yields to the other handles
+        static constexpr std::size_t inline_budget = 256 * 1024;
+
+        static bool take_inline(uv_loop_t* loop, std::size_t total) noexcept
+        {
+            static thread_local uint64_t tick = UINT64_MAX;
+            static thread_local std::size_t left = 0;
+            if (uint64_t now = uv_now(loop); now != tick) {
+                tick = now;
+                left = inline_budget;
+            }
+            if (total > left) {
+                left = 0;
+                return false;
+            }
+            left -= total;
+            return true;
+        }
+
+        // tries to write synchronously first and queues only what the socket did not take
+        error_code send(uv_buf_t* bufs, std::size_t nbufs, std::size_t total)
+        {
+            int written = take_inline(data->stream->loop, total) ? uv_try_write(data->stream.get(), bufs, nbufs) : UV_EAGAIN;
+            [[likely]] if (written >= 0 && static_cast<std::size_t>(written) == total) {
+                data->status = 0;
+                return 0;
+            }
+            if (written > 0) {
+                std::size_t skip = written;
+                while (skip >= bufs->len) {
+                    skip -= bufs->len;
+                    ++bufs;
+                    --nbufs;
+                }
+                bufs->base += skip;
+                bufs->len -= skip;
+            } else if (written != UV_EAGAIN && written != UV_ENOSYS) {
+                data->status = written;
+                return written;
+            }
+
+            data->status = uv_write(&data->write_handle, data->stream.get(), bufs, nbufs,
+                [](uv_write_t* write_handle, int status) {
+                    auto data = static_cast<writer_data*>(write_handle->data);
+                    data->status = status;
+                    if (data->co_handle) {
+                        data->node.resume(write_handle->handle->loop, std::exchange(data->co_handle, nullptr));
+                    } 
+                });
+
+            if (data->status == 0) {
+                data->status = 1;
+            }
+            return data->status < 0 ? data->status : 0;
+        }
+
     public:
         writer(const tcp&);
+        writer(const pipe&);
+
+        // already completed with status
+        writer(error_code status) : data{new writer_data{}}
+        {
+            data->status = status;
+        }
+
         writer(writer&&) = default;
         writer& operator=(writer&&) = default;
 
         error_code write(std::string some_data)
         {
             data->to_write = std::move(some_data);
-            data->status = 1;
             uv_buf_t buf = uv_buf_init(data->to_write.data(), data->to_write.size());
-            return uv_write(&data->write_handle, data->stream.get(), &buf, 1,
-                [](uv_write_t* write_handle, int status) {
-                    auto data = static_cast<writer_data*>(write_handle->data);
-                    data->status = status;
-                    if (data->co_handle) {
-                        data->co_handle();  
-                    } 
-                });
+            return send(&buf, 1, buf.len);
+        }
+
+        // every slice goes out in one gathered write, the chain keeps their owners alive until it completes
+        error_code write(buffer_chain chain)
+        {
+            data->chain = std::move(chain);
+            auto parts = data->chain.parts();
+            // libuv copies the buffer list when it has to queue, so it can live on the stack
+            uv_buf_t inline_bufs[8];
+            std::vector<uv_buf_t> heap_bufs;
+            uv_buf_t* bufs = inline_bufs;
+            if (parts.size() > std::size(inline_bufs)) {
+                heap_bufs.resize(parts.size());
+                bufs = heap_bufs.data();
+            }
+            for (std::size_t i = 0; i < parts.size(); ++i) {
+                bufs[i] = uv_buf_init(const_cast<char*>(parts[i].data), parts[i].size);
+            }
+            return send(bufs, parts.size(), data->chain.size());
         }
         
         bool await_ready() const noexcept { return data->status <= 0; }
@@ -59,6 +145,9 @@ namespace couv
 
         ~writer() 
         {
+            if (data) {
+                data->node.cancel();
+            }
             if (data && data->status == 1) 
             {
                 data->write_handle.cb = [](uv_write_t* write_handle, int) {
@@ -7,6 +7,14 @@
 #include <gmock/gmock.h>
 
 #include <couv.hpp>
+#include <tls.hpp>
+#include <sim.hpp>
+#include <redis.hpp>
+#include <pipe_through.hpp>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
 #include <thread>
 #include <chrono>
 
@@ -30,24 +38,457 @@ couv::task<> tcp_test()
     }
 }
 
-couv::task<> tcp_server_test()
+couv::task<> echo(couv::tcp client)
+{
+    auto reader = client.read();
+    while (auto data = co_await reader) {
+        co_await client.write(data);
+    }
+}
+
+couv::task<> tcp_server_test(couv::task_group& clients)
 {
     couv::tcp tcp;
-    std::vector<couv::tcp> clients;
-    co_await tcp.bind("0.0.0.0", 8080);
+    co_await tcp.bind("0.0.0.0", 8080, {.nodelay = true});
 
     auto listner = tcp.listen(128);
     while (true) {
         std::cout << "tcp listen" << std::endl;
-        if (co_await listner) {
+        if (co_await listner == 0) {
+            couv::tcp client;
+            if (tcp.accept(client) == 0) {
+                clients.spawn(echo(std::move(client)));
+            }
+        }
+    }
+}
+
+struct self_signed
+{
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+
+    self_signed()
+    {
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        auto name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509_sign(cert, key, EVP_sha256());
+    }
+};
+
+couv::task<> tls_server_test(const self_signed& id)
+{
+    couv::tls_context ctx{couv::tls_context::server_mode};
+    ctx.use_certificate(id.cert, id.key);
+
+    couv::tcp tcp;
+    co_await tcp.bind("127.0.0.1", 8443);
+    auto listner = tcp.listen(128);
+    for (int i = 0; i < 2; ++i) {
+        co_await listner;
+        couv::tcp client;
+        tcp.accept(client);
+        couv::tls_stream tls{std::move(client), ctx};
+        if (co_await tls.handshake(true)) {
+            auto data = co_await tls.read();
+            co_await tls.write(data.value());
+        }
+    }
+}
+
+couv::task<> tls_test()
+{
+    self_signed id;
+    auto server_task = tls_server_test(id);
+
+    couv::tls_context ctx{couv::tls_context::client_mode};
+    ctx.trust(id.cert);
+    couv::tls_session session;
+    for (int i = 0; i < 2; ++i) {
+        couv::tcp tcp;
+        co_await tcp.connect("127.0.0.1", 8443);
+        couv::tls_stream tls{std::move(tcp), ctx};
+        tls.set_hostname("localhost");
+        if (session) {
+            tls.set_session(session);
+        }
+        co_await tls.handshake();
+        co_await tls.write("tls echo");
+        auto data = co_await tls.read();
+        std::cout << data.value() << " resumed " << tls.resumed() << std::endl;
+        session = tls.session();
+        co_await tls.shutdown();
+    }
+}
+
+couv::task<> sim_echo(couv::sim::stream client)
+{
+    auto reader = client.read();
+    while (auto data = co_await reader) {
+        co_await client.write({data, reader.size()});
+    }
+}
+
+couv::task<> sim_server(couv::sim::acceptor& server, couv::task_group& clients)
+{
+    while (true) {
+        co_await server;
+        couv::sim::stream client;
+        server.accept(client);
+        clients.spawn(sim_echo(std::move(client)));
+    }
+}
+
+couv::task<> sim_client(couv::sim::acceptor& server, const couv::sim::link& link, uint64_t& total)
+{
+    auto& loop = couv::sim::virtual_loop::current();
+    couv::sim::stream stream;
+    co_await stream.connect(server, link);
+    uint64_t start = loop.now();
+    co_await stream.write(std::string(4096, 'x'));
+    auto reader = stream.read();
+    for (std::size_t n = 0; n < 4096; n += reader.size()) {
+        if (!co_await reader) {
+            break;
+        }
+    }
+    total += loop.now() - start;
+}
+
+// the real couv::reader and couv::writer over a simulated link
+couv::task<> wire_echo(couv::pipe& end)
+{
+    auto reader = end.read();
+    while (auto data = co_await reader) {
+        co_await end.write(std::string{data, reader.size()});
+    }
+}
+
+couv::task<> wire_client(couv::pipe& end, std::size_t size, uint64_t& elapsed)
+{
+    auto& loop = couv::sim::virtual_loop::current();
+    uint64_t start = loop.now();
+    co_await end.write(std::string(size, 'x'));
+    auto reader = end.read();
+    std::size_t n = 0;
+    while (n < size) {
+        if (!co_await reader) {
+            break;
+        }
+        n += reader.size();
+    }
+    elapsed = loop.now() - start;
+    end.close();
+}
+
+void sim_test() // virtual time, same result on every run
+{
+    couv::sim::virtual_loop loop{42};
+    couv::sim::acceptor server{1024};
+    couv::task_group clients;
+    auto server_task = sim_server(server, clients);
+
+    couv::sim::link link{.latency = 1'000'000, .bandwidth = 10'000'000, .loss = 0.01};
+    uint64_t total = 0;
+    std::vector<couv::task<>> tasks;
+    for (int i = 0; i < 1000; ++i) {
+        tasks.push_back(sim_client(server, link, total));
+    }
+    auto events = loop.run();
+    std::cout << "sim " << events << " events, mean rtt " << total / tasks.size() << "ns" << std::endl;
+
+    couv::sim::wire wire{{.latency = 1'000'000, .bandwidth = 10'000'000}};
+    uint64_t elapsed = 0;
+    auto echo_task = wire_echo(wire.server());
+    auto client_task = wire_client(wire.client(), 64 * 1024, elapsed);
+    loop.run();
+    std::cout << "sim wire echoed 64KiB in " << elapsed << "ns" << std::endl;
+}
+
+// stand-in for a redis server, enough of RESP for the client test
+couv::task<> resp_session(couv::tcp client, std::map<std::string, std::string, std::less<>>& store, int& reads)
+{
+    auto reader = client.read();
+    std::string received;
+    while (auto data = co_await reader) {
+        ++reads;
+        received.append(data, reader.size());
+        std::string replies;
+        std::size_t pos = 0;
+        couv::redis_reply request;
+        while (couv::resp::parse(received, pos, request) > 0) {
+            auto& args = request.elements;
+            auto name = args.empty() ? std::string_view{} : args[0].str;
+            if (name == "PING") {
+                replies += "+PONG\r\n";
+            } else if (name == "SET" && args.size() == 3) {
+                store[std::string{args[1].str}] = args[2].str;
+                replies += "+OK\r\n";
+            } else if (name == "GET" && args.size() == 2) {
+                auto found = store.find(args[1].str);
+                if (found == store.end()) {
+                    replies += "$-1\r\n";
+                } else {
+                    couv::resp::append_bulk(replies, found->second);
+                }
+            } else if (name == "INCR" && args.size() == 2) {
+                auto& value = store[std::string{args[1].str}];
+                value = std::to_string(std::atoll(value.c_str()) + 1);
+                replies += ":" + value + "\r\n";
+            } else {
+                replies += "-ERR unknown command\r\n";
+            }
+        }
+        received.erase(0, pos);
+        co_await client.write(std::move(replies));
+    }
+}
+
+couv::task<> resp_server(couv::tcp& tcp, std::map<std::string, std::string, std::less<>>& store, int& reads)
+{
+    couv::task_group sessions;
+    auto listner = tcp.listen(16);
+    while (true) {
+        if (co_await listner == 0) {
             couv::tcp client;
-            if (tcp.accept(client)) {
-                clients.push_back(std::move(client));
+            if (tcp.accept(client) == 0) {
+                sessions.spawn(resp_session(std::move(client), store, reads));
             }
         }
     }
 }
 
+couv::task<> redis_incr(couv::redis& db, int64_t& highest)
+{
+    auto reply = co_await db.cmd("INCR", "counter");
+    highest = std::max(highest, reply.value().integer);
+}
+
+couv::task<> redis_test() // concurrent commands share one write and one read
+{
+    std::map<std::string, std::string, std::less<>> store;
+    int reads = 0;
+    couv::tcp tcp;
+    co_await tcp.bind("127.0.0.1", 6390);
+    auto server = resp_server(tcp, store, reads);
+
+    couv::redis db;
+    co_await db.connect("127.0.0.1", 6390);
+    co_await db.cmd("SET", "greeting", "hello");
+    auto greeting = co_await db.cmd("GET", "greeting");
+    std::cout << "redis get " << greeting.value().str << std::endl;
+
+    int64_t highest = 0;
+    couv::task_group clients;
+    for (int i = 0; i < 100; ++i) {
+        clients.spawn(redis_incr(db, highest));
+    }
+    co_await clients.join();
+    std::cout << "redis counter " << highest << " server reads " << reads << std::endl;
+}
+
+couv::task<> send_and_close(couv::tcp& tcp, std::string data)
+{
+    co_await tcp.write(std::move(data));
+    tcp.shutdown();
+}
+
+couv::task<> relay_test() // a proxy in front of the echo server, bytes move socket to socket in the kernel
+{
+    couv::tcp front;
+    co_await front.bind("127.0.0.1", 8081);
+    auto listner = front.listen(16);
+
+    couv::tcp client;
+    auto connecting = client.connect("127.0.0.1", 8081);
+    co_await listner;
+    couv::tcp inbound;
+    front.accept(inbound);
+    co_await connecting;
+    couv::tcp outbound;
+    co_await outbound.connect("127.0.0.1", 8080);
+    auto relay = couv::proxy(inbound, outbound);
+
+    std::string message(1 << 20, 'r');
+    auto sender = send_and_close(client, message);
+    std::size_t received = 0;
+    auto reader = client.read();
+    while (co_await reader) {
+        received += reader.size();
+    }
+    auto moved = co_await relay;
+    std::cout << "relay echoed " << received << " of " << message.size() << " bytes, proxied "
+        << moved.value().first << " up " << moved.value().second << " down" << std::endl;
+}
+
+// the restarted process: accepts on the listener it inherited instead of binding again
+couv::task<> serve_inherited()
+{
+    couv::tcp tcp;
+    co_await tcp.open(couv::inherited_listener(0));
+    auto listner = tcp.listen(16);
+    co_await listner;
+    couv::tcp client;
+    tcp.accept(client);
+    co_await client.write(std::string{"served by the new process"});
+    client.shutdown();
+}
+
+couv::task<> handoff_test(char* program) // a restart keeps the listening socket, queued clients reach the new process
+{
+    {
+        couv::tcp tcp;
+        co_await tcp.bind("127.0.0.1", 8082);
+        auto listner = tcp.listen(16);
+        std::string inherited{"--inherited"};
+        std::array<char*, 3> args{program, inherited.data(), nullptr};
+        auto handed_off = couv::handoff(args.data(), {&tcp});
+        co_await handed_off;
+    } // this process stops accepting, the queue is the new one's
+
+    couv::tcp client;
+    co_await client.connect("127.0.0.1", 8082);
+    std::string reply;
+    auto reader = client.read();
+    while (auto data = co_await reader) {
+        reply.append(data, reader.size());
+    }
+    std::cout << "after handoff " << reply << std::endl;
+}
+
+couv::task<> ticker_test() // ticks a blocked loop missed are counted, not lost
+{
+    using namespace std::chrono_literals;
+    couv::ticker ticker{10};
+    co_await ticker;
+    std::this_thread::sleep_for(55ms);
+    auto late = co_await ticker;
+    std::cout << "ticker caught up " << late.count << " ticks after the loop was blocked" << std::endl;
+}
+
+template <typename Limiter>
+couv::task<> paced(Limiter& limiter, int n, int& passed)
+{
+    for (int i = 0; i < n; ++i) {
+        co_await limiter.acquire();
+        ++passed;
+    }
+}
+
+template <typename Limiter>
+couv::task<> limit(Limiter& limiter, const char* name)
+{
+    uint64_t start = uv_hrtime();
+    int passed = 0;
+    couv::task_group senders;
+    for (int i = 0; i < 5; ++i) {
+        senders.spawn(paced(limiter, 10, passed));
+    }
+    co_await senders.join();
+    std::cout << name << " let " << passed << " through in " << (uv_hrtime() - start) / 1000000
+        << "ms, next try " << (limiter.try_acquire() ? "passes" : "waits") << std::endl;
+}
+
+couv::task<> rate_limit_test() // 100 per second after a burst of 10, every parked waiter shares one timer
+{
+    couv::rate_limiter bucket{100, 10};
+    couv::gcra_limiter cell{100, 10};
+    couv::task_group limits;
+    limits.spawn(limit(bucket, "token bucket"));
+    limits.spawn(limit(cell, "gcra"));
+
+    // a waiter that gives up leaves the shared timer queue, its reservation stays taken
+    int gave_up = 0;
+    couv::task_group impatient;
+    impatient.spawn(paced(bucket, 1, gave_up));
+    co_await couv::timer(50);
+    impatient.cancel();
+    co_await limits.join();
+}
+
+couv::task<> line_client()
+{
+    couv::tcp tcp;
+    co_await tcp.connect("127.0.0.1", 8083);
+    co_await tcp.write(std::string{"PING\r"});
+    co_await couv::timer(5);
+    std::string rest = "\nHELLO world\r\n";
+    for (int i = 0; i < 40; ++i) {
+        rest += std::string(99, 'x') + "\n";
+    }
+    rest += std::string(300, 'y') + "\n";
+    co_await tcp.write(std::move(rest));
+    tcp.shutdown();
+}
+
+couv::task<> buffered_test() // a delimiter split across reads, then a line across the wrap of a 4 KiB mirrored ring
+{
+    couv::tcp server;
+    co_await server.bind("127.0.0.1", 8083);
+    auto listner = server.listen(16);
+    auto client_task = line_client();
+    co_await listner;
+    couv::tcp tcp;
+    server.accept(tcp);
+
+    couv::buffered_reader input{tcp, 4000, true};
+    std::string ping{(co_await input.read_until("\r\n")).value()};
+    std::string peeked{(co_await input.peek(5)).value().substr(0, 5)};
+    std::string greeting{(co_await input.readline()).value()};
+    int lines = 0;
+    while (true) {
+        auto line = co_await input.readline();
+        if (!line || line.value().size() != 99) {
+            bool wrapped = line && line.value() == std::string(300, 'y');
+            std::cout << "buffered " << ping.size() << " byte ping, peeked " << peeked << " before " << greeting
+                << ", " << lines << " lines, wrapped line " << (wrapped ? "intact" : "broken") << std::endl;
+            break;
+        }
+        ++lines;
+    }
+}
+
+couv::task<> hop_client()
+{
+    couv::tcp tcp;
+    co_await tcp.connect("127.0.0.1", 8084);
+    auto reader = tcp.read();
+    std::string reply;
+    while (auto data = co_await reader) {
+        reply.append(data, reader.size());
+    }
+    std::cout << reply << std::endl;
+}
+
+couv::task<> migrate_test(couv::event_loop& worker) // accepted on this loop, the connection is served on the worker loop
+{
+    couv::tcp server;
+    co_await server.bind("127.0.0.1", 8084);
+    auto listner = server.listen(16);
+    auto client_task = hop_client();
+    co_await listner;
+    couv::tcp accepted;
+    server.accept(accepted);
+    auto fd = accepted.detach();
+    auto accepted_on = std::this_thread::get_id();
+
+    co_await couv::schedule_on(worker);
+    {
+        couv::tcp connection;
+        co_await connection.open(fd);
+        co_await connection.write(std::string{"accepted on another thread: "} +
+            (accepted_on != std::this_thread::get_id() ? "yes" : "no"));
+        connection.shutdown();
+    }
+    // the listener and the client belong to the first loop, so they are finished there
+    co_await couv::schedule_on(couv::event_loop::main());
+    co_await client_task;
+}
+
 couv::task<> timer_test()
 {
     std::cout << "timer start" << std::endl;
@@ -55,6 +496,123 @@ couv::task<> timer_test()
     std::cout << "timer test" << std::endl;
 }
 
+couv::task<> limited_timer(couv::semaphore& slots, int ms)
+{
+    co_await slots.acquire();
+    co_await couv::timer(ms);
+    slots.release();
+}
+
+couv::task<> sync_test() // at most two timers run at once
+{
+    couv::semaphore slots{2};
+    couv::task_group timers;
+    for (int ms : {100, 200, 300, 400}) {
+        timers.spawn(limited_timer(slots, ms));
+    }
+    co_await timers.join();
+    std::cout << "sync test" << std::endl;
+}
+
+couv::task<> guarded_increment(couv::mutex& m, int& value)
+{
+    auto guard = co_await m.scoped_lock();
+    int seen = value;
+    co_await couv::timer(1); // the others queue on the mutex meanwhile
+    value = seen + 1;
+}
+
+couv::task<> consume(couv::mutex& m, couv::condition_variable& ready, std::deque<int>& queue, int& sum, couv::event& finished)
+{
+    co_await m.lock();
+    while (true) {
+        while (queue.empty()) {
+            co_await ready.wait(m);
+        }
+        int value = queue.front();
+        queue.pop_front();
+        if (value < 0) {
+            break;
+        }
+        sum += value;
+    }
+    m.unlock();
+    finished.set();
+}
+
+couv::task<> shared_increment(couv::thread_safe_mutex& m, int& value, std::atomic<int>& left, couv::thread_safe_event& done)
+{
+    co_await m.lock();
+    ++value;
+    m.unlock();
+    if (--left == 0) {
+        done.set();
+    }
+}
+
+couv::task<> lock_test(couv::event_loop& other) // loop local primitives, then thread safe ones shared by two loops
+{
+    couv::mutex m;
+    int value = 0;
+    couv::task_group increments;
+    for (int i = 0; i < 10; ++i) {
+        increments.spawn(guarded_increment(m, value));
+    }
+    co_await increments.join();
+
+    couv::condition_variable ready;
+    couv::event finished;
+    std::deque<int> queue;
+    int sum = 0;
+    auto consumer = consume(m, ready, queue, sum, finished);
+    for (int item : {1, 2, 3, -1}) {
+        co_await m.lock();
+        queue.push_back(item);
+        m.unlock();
+        ready.notify_one();
+        co_await couv::timer(1);
+    }
+    co_await finished;
+
+    couv::thread_safe_mutex shared_lock;
+    couv::thread_safe_event done;
+    int shared = 0;
+    std::atomic<int> left{200};
+    couv::task_group local;
+    for (int i = 0; i < 100; ++i) {
+        couv::spawn(other, shared_increment, std::ref(shared_lock), std::ref(shared), std::ref(left), std::ref(done));
+        local.spawn(shared_increment(shared_lock, shared, left, done));
+    }
+    co_await done;
+    std::cout << "lock test " << value << " increments, consumed " << sum << ", " << shared << " across loops" << std::endl;
+}
+
+couv::task<> idle_worker(int rounds, std::size_t& most_resumed)
+{
+    couv::idle idle{true};
+    for (int i = 0; i < rounds; ++i) {
+        co_await idle;
+        most_resumed = std::max(most_resumed, couv::event_loop::current().last_batch().resumed);
+    }
+}
+
+couv::task<> deferred_test(couv::event_loop& batched) // 16 busy handles, at most 4 resume per loop iteration
+{
+    co_await couv::schedule_on(batched);
+    batched.set_deferred(4);
+    std::size_t most_resumed = 0;
+    couv::task_group workers;
+    for (int i = 0; i < 16; ++i) {
+        workers.spawn(idle_worker(100, most_resumed));
+    }
+    co_await workers.join();
+    auto& batch = batched.last_batch();
+    std::cout << "deferred at most " << most_resumed << " per batch, last batch left " << batch.pending
+        << " pending, waited up to " << batch.max_latency / 1000 << "us" << std::endl;
+    batched.set_deferred(0);
+    co_await couv::schedule_on(couv::event_loop::main());
+}
+
 couv::work<double> worker(couv::async_sender<int> sender) // thread pool work
 {
     std::cout << "doing work on " << std::this_thread::get_id() << std::endl;
@@ -85,20 +643,155 @@ couv::task<> work_test()
     std::cout << "work finished " << i.value() << std::endl;
 }
 
+couv::work_stream<double, int> stream_worker() // progress through a lock free ring
+{
+    using namespace std::chrono_literals;
+    for (int a = 10; a; --a) {
+        std::this_thread::sleep_for(200ms);
+        co_yield a;
+    }
+    co_return 100;
+}
+
+couv::task<> work_stream_test()
+{
+    auto work = stream_worker();
+    while (auto a = co_await work.progress()) {
+        std::cout << "stream progress " << *a << std::endl;
+    }
+    std::cout << "stream finished " << (co_await work).value() << std::endl;
+}
+
+couv::task<> process_test() // child output streamed through the loop, no thread per child
+{
+    couv::process upper{{"tr", "a-z", "A-Z"}, {.in = true}};
+    upper.in().write("hello from a child process\n");
+    upper.in().close();
+    auto reader = upper.out().read();
+    while (auto data = co_await reader) {
+        std::cout << data;
+    }
+    std::cout << "child exited with " << (co_await upper.exit()).value() << std::endl;
+}
+
+couv::task<> reload_test() // bursts of writes to the watched directory arrive as one batch
+{
+    couv::fs_event config{"."};
+    auto changes = co_await config;
+    while (!changes.empty()) {
+        for (auto& change : changes) {
+            std::cout << "reload after change to " << change.path << std::endl;
+        }
+        changes = co_await config;
+    }
+    std::cout << "config watch failed " << (int)config.error() << std::endl;
+}
+
+couv::task<> parallel_test() // one awaitable for the whole batch instead of a work per record
+{
+    std::vector<std::string> records(100000);
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        records[i] = "record " + std::to_string(i);
+    }
+    std::vector<std::size_t> hashes(records.size());
+    co_await couv::parallel_for(std::views::iota(std::size_t{0}, records.size()), 0, [&](std::size_t i) {
+        hashes[i] = std::hash<std::string>{}(records[i]);
+    });
+    auto longest = co_await couv::parallel_reduce(records, 0, std::size_t{0},
+        [](std::size_t acc, const std::string& r) { return std::max(acc, r.size()); },
+        [](std::size_t a, std::size_t b) { return std::max(a, b); });
+    std::cout << "hashed " << hashes.size() << " records, longest " << longest.value() << std::endl;
+}
+
+couv::task<> watch_routes(couv::rcu<std::map<std::string, int>>& routes, int last, std::atomic<bool>& seen)
+{
+    while (routes.read().at("/api") != last) {
+        co_await couv::timer(1);
+    }
+    seen = true;
+}
+
+couv::task<> rcu_test() // readers on any loop see a stable snapshot, writers never block them
+{
+    couv::rcu<std::map<std::string, int>> routes{std::map<std::string, int>{{"/", 8080}}};
+    routes.update([](auto& table) { table["/api"] = 8081; });
+    co_await couv::timer(1);
+    for (auto& [prefix, port] : routes.read()) {
+        std::cout << "route " << prefix << " -> " << port << std::endl;
+    }
+
+    // a second loop reads while this one publishes, each old version waits for both loops
+    couv::event_loop readers;
+    std::thread readers_thread{[&] { readers.run(); }};
+    std::atomic<bool> seen{false};
+    couv::spawn(readers, watch_routes, std::ref(routes), 8181, std::ref(seen));
+    for (int port = 8082; port <= 8181; ++port) {
+        routes.update([port](auto& table) { table["/api"] = port; });
+        co_await couv::timer(1);
+    }
+    while (!seen || routes.pending()) {
+        co_await couv::timer(1);
+    }
+    std::cout << "rcu reader loop saw the last of 100 versions, " << routes.pending() << " left to free" << std::endl;
+    readers.stop();
+    readers_thread.join();
+}
+
 couv::task<> signal_test()
 {
-    auto server_task = tcp_server_test();
-    auto work_task = work_test();
-    co_await couv::signal{2};
-    std::cout << "got sigint cancel server and work" << std::endl;
+    couv::shutdown shutdown;
+    couv::task_group servers;
+    couv::task_group clients;
+    couv::task_group work;
+    shutdown.stop(servers);
+    shutdown.drain(clients);
+    shutdown.drain(work);
+
+    servers.spawn(tcp_server_test(clients));
+    work.spawn(work_test());
+    work.spawn(work_stream_test());
+    std::cout << "got signal " << (co_await shutdown.wait()).value() << ", draining clients and work" << std::endl;
+    co_await shutdown.run(5000);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::string_view{argv[1]} == "--inherited") {
+        auto inherited_task = serve_inherited();
+        return couv::loop();
+    }
+
+    couv::event_loop::main();
+    couv::event_loop other;
+    std::thread other_thread{[&] { other.run(); }};
+    couv::event_loop batched;
+    std::thread batched_thread{[&] { batched.run(); }};
+
+    sim_test();
     auto tcp_task = tcp_test();
     auto signal_task = signal_test();
     auto timer_task = timer_test();
+    auto ticker_task = ticker_test();
+    auto rate_limit_task = rate_limit_test();
+    auto buffered_task = buffered_test();
+    auto sync_task = sync_test();
+    auto lock_task = lock_test(other);
+    auto deferred_task = deferred_test(batched);
+    auto migrate_task = migrate_test(other);
+    auto redis_task = redis_test();
+    auto relay_task = relay_test();
+    auto handoff_task = handoff_test(argv[0]);
+    auto process_task = process_test();
+    auto reload_task = reload_test();
+    auto parallel_task = parallel_test();
+    auto rcu_task = rcu_test();
+    auto tls_task = tls_test();
     
     std::cout << "loop run" << std::endl;
-    return couv::loop();
+    int ret = couv::loop();
+    other.stop();
+    other_thread.join();
+    batched.stop();
+    batched_thread.join();
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+// drives request/response traffic against an echo style server and reports latency percentiles
+//
+//   couv_loadgen [host=127.0.0.1] [port=8080] [connections=16] [duration=10] [rate=0] [size=64] [timeout=1000]
+//
+// rate 0 runs closed loop, every connection sends its next request as soon as the
+// previous response arrived. A rate in requests per second runs open loop, each
+// connection sends on a fixed schedule and latency is measured from the scheduled
+// send time, so a stalled server is not hidden by requests that were never sent.
+// Responses still outstanding timeout ms after the run ends are counted as timed out
+
+#include <couv.hpp>
+#include <hdr_histogram.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+struct options
+{
+    std::string host{"127.0.0.1"};
+    int port{8080};
+    int connections{16};
+    uint64_t duration{10};  // seconds
+    uint64_t rate{0};       // requests per second over all connections
+    std::size_t size{64};   // request bytes, the server must echo as many
+    uint64_t timeout{1000}; // ms to wait for outstanding responses once the duration ends
+};
+
+struct results
+{
+    hdr_histogram latency;  // microseconds
+    uint64_t requests{0};
+    uint64_t errors{0};
+    uint64_t timeouts{0};
+    uint64_t outstanding{0};
+    uint64_t stopped{0};    // hrtime when the duration ended
+    bool stopping{false};
+};
+
+couv::task<> connection(const options& opts, results& res, uint64_t offset)
+{
+    couv::tcp tcp;
+    couv::error_code err = co_await tcp.connect(opts.host.c_str(), opts.port, {.nodelay = true});
+    if (err) {
+        std::fprintf(stderr, "connect: %s\n", uv_strerror(err));
+        ++res.errors;
+    }
+
+    auto reader = tcp.read();
+    std::string request(opts.size, 'x');
+    uint64_t interval = opts.rate ? uint64_t(opts.connections) * 1'000'000'000 / opts.rate : 0;
+    uint64_t next = uv_hrtime() + offset;
+
+    while (!err && !res.stopping) {
+        uint64_t now = uv_hrtime();
+        if (interval && next > now + 1'000'000) {
+            co_await couv::timer((next - now) / 1'000'000);
+            now = uv_hrtime();
+        }
+        // timers tick in whole milliseconds, a request that goes out early counts from its send
+        uint64_t intended = interval ? std::min(next, now) : now;
+
+        if (co_await tcp.write(request)) {
+            ++res.errors;
+            break;
+        }
+        ++res.outstanding;
+        std::size_t received = 0;
+        while (received < request.size()) {
+            if (!co_await reader) {
+                break;
+            }
+            received += reader.size();
+        }
+        --res.outstanding;
+        if (received < request.size()) {
+            ++res.errors;
+            break;
+        }
+
+        res.latency.record((uv_hrtime() - intended) / 1000);
+        ++res.requests;
+        next += interval;
+    }
+}
+
+couv::task<> run(const options& opts, results& res)
+{
+    couv::task_group connections;
+    uint64_t spread = opts.rate ? 1'000'000'000 / opts.rate : 0;
+    for (int i = 0; i < opts.connections; ++i) {
+        connections.spawn(connection(opts, res, i * spread));
+    }
+    co_await couv::timer(opts.duration * 1000);
+    res.stopping = true;
+    res.stopped = uv_hrtime();
+
+    // a server that stopped answering would keep connections waiting forever,
+    // cancelling them closes their sockets
+    uint64_t deadline = uv_hrtime() + opts.timeout * 1'000'000;
+    while (connections.size() && uv_hrtime() < deadline) {
+        co_await couv::timer(10);
+    }
+    res.timeouts = res.outstanding;
+    connections.cancel();
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = std::strchr(arg, '=');
+        if (!value) {
+            std::fprintf(stderr, "expected key=value, got %s\n", arg);
+            return 1;
+        }
+        std::string key{arg, value++};
+        if (key == "host") opts.host = value;
+        else if (key == "port") opts.port = std::atoi(value);
+        else if (key == "connections") opts.connections = std::max(1, std::atoi(value));
+        else if (key == "duration") opts.duration = std::strtoull(value, nullptr, 10);
+        else if (key == "rate") opts.rate = std::strtoull(value, nullptr, 10);
+        else if (key == "size") opts.size = std::max<std::size_t>(1, std::strtoull(value, nullptr, 10));
+        else if (key == "timeout") opts.timeout = std::strtoull(value, nullptr, 10);
+        else {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    results res;
+    uint64_t start = uv_hrtime();
+    auto task = run(opts, res);
+    couv::loop();
+    double elapsed = (res.stopped - start) / 1e9;
+
+    std::printf("%s loop, %d connections, %.2fs\n", opts.rate ? "open" : "closed", opts.connections, elapsed);
+    std::printf("requests %llu, errors %llu, timeouts %llu, %.0f req/s\n",
+        (unsigned long long)res.requests, (unsigned long long)res.errors,
+        (unsigned long long)res.timeouts, res.requests / elapsed);
+    std::printf("latency us: min %lld mean %.1f max %lld\n",
+        (long long)res.latency.min(), res.latency.mean(), (long long)res.latency.max());
+    for (double p : {50.0, 90.0, 99.0, 99.9, 99.99}) {
+        std::printf("  p%-6g %lld\n", p, (long long)res.latency.percentile(p));
+    }
+    return res.errors || res.timeouts ? 2 : 0;
+}
@@ -0,0 +1,179 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+// compares rpc calls multiplexed over one connection with a fresh connection per call
+//
+//   couv_rpc_bench [port=9090] [loops=2] [callers=64] [duration=5] [size=64]
+//
+// The echo server runs in process, accepting on the main loop and serving on loops worker
+// threads. Both runs use callers concurrent callers for duration seconds each
+
+#include <couv.hpp>
+#include <rpc.hpp>
+#include <hdr_histogram.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct options
+{
+    int port{9090};
+    int loops{2};
+    int callers{64};
+    uint64_t duration{5};  // seconds per run
+    std::size_t size{64};  // request bytes
+};
+
+struct results
+{
+    hdr_histogram latency;  // microseconds
+    uint64_t calls{0};
+    uint64_t errors{0};
+    bool stopping{false};
+};
+
+constexpr uint16_t echo_method = 1;
+
+couv::task<> multiplexed(couv::rpc::client& client, const options& opts, results& res)
+{
+    std::string request(opts.size, 'x');
+    while (!res.stopping) {
+        uint64_t start = uv_hrtime();
+        auto response = co_await client.call(echo_method, request);
+        if (!response || response.value().size() != request.size()) {
+            ++res.errors;
+            break;
+        }
+        res.latency.record((uv_hrtime() - start) / 1000);
+        ++res.calls;
+    }
+}
+
+couv::task<> per_connection(const options& opts, results& res)
+{
+    std::string request(opts.size, 'x');
+    while (!res.stopping) {
+        uint64_t start = uv_hrtime();
+        couv::rpc::client client;
+        auto connected = co_await client.connect("127.0.0.1", opts.port);
+        if (!connected) {
+            ++res.errors;
+            break;
+        }
+        auto response = co_await client.call(echo_method, request);
+        if (!response || response.value().size() != request.size()) {
+            ++res.errors;
+            break;
+        }
+        res.latency.record((uv_hrtime() - start) / 1000);
+        ++res.calls;
+    }
+}
+
+void report(const char* name, const results& res, double elapsed)
+{
+    std::printf("%-15s calls %9llu  errors %llu  %9.0f calls/s  p50 %lldus  p99 %lldus\n", name,
+        (unsigned long long)res.calls, (unsigned long long)res.errors, res.calls / elapsed,
+        (long long)res.latency.percentile(50), (long long)res.latency.percentile(99));
+}
+
+couv::task<> run(const options& opts, std::vector<std::unique_ptr<couv::event_loop>>& loops)
+{
+    couv::rpc::server server;
+    server.handle(echo_method, [](couv::rpc::stream& call) -> couv::task<> {
+        auto request = co_await call.read_all();
+        if (request) {
+            co_await call.write(std::move(request.value()), true);
+        }
+    });
+    std::vector<couv::event_loop*> targets;
+    for (auto& loop : loops) {
+        targets.push_back(loop.get());
+    }
+    auto listening = server.listen("127.0.0.1", opts.port, targets);
+
+    {
+        results res;
+        couv::rpc::client client;
+        if (auto connected = co_await client.connect("127.0.0.1", opts.port); !connected) {
+            std::fprintf(stderr, "connect: %s\n", uv_strerror(connected.error()));
+        } else {
+            uint64_t start = uv_hrtime();
+            std::vector<couv::task<>> callers;
+            for (int i = 0; i < opts.callers; ++i) {
+                callers.push_back(multiplexed(client, opts, res));
+            }
+            co_await couv::timer(opts.duration * 1000);
+            res.stopping = true;
+            for (auto& c : callers) {
+                co_await c;
+            }
+            report("multiplexed", res, (uv_hrtime() - start) / 1e9);
+        }
+    }
+    {
+        results res;
+        uint64_t start = uv_hrtime();
+        std::vector<couv::task<>> callers;
+        for (int i = 0; i < opts.callers; ++i) {
+            callers.push_back(per_connection(opts, res));
+        }
+        co_await couv::timer(opts.duration * 1000);
+        res.stopping = true;
+        for (auto& c : callers) {
+            co_await c;
+        }
+        report("per connection", res, (uv_hrtime() - start) / 1e9);
+    }
+
+    for (auto& loop : loops) {
+        loop->stop();
+    }
+    uv_stop(uv_default_loop());
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = std::strchr(arg, '=');
+        if (!value) {
+            std::fprintf(stderr, "expected key=value, got %s\n", arg);
+            return 1;
+        }
+        std::string key{arg, value++};
+        if (key == "port") opts.port = std::atoi(value);
+        else if (key == "loops") opts.loops = std::max(0, std::atoi(value));
+        else if (key == "callers") opts.callers = std::max(1, std::atoi(value));
+        else if (key == "duration") opts.duration = std::strtoull(value, nullptr, 10);
+        else if (key == "size") opts.size = std::strtoull(value, nullptr, 10);
+        else {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    couv::event_loop::main();
+    std::vector<std::unique_ptr<couv::event_loop>> loops;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.loops; ++i) {
+        auto& loop = *loops.emplace_back(std::make_unique<couv::event_loop>());
+        threads.emplace_back([&loop] { loop.run(); });
+    }
+
+    auto task = run(opts, loops);
+    couv::loop();
+    for (auto& t : threads) {
+        t.join();
+    }
+    return 0;
+}
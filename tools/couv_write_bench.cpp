@@ -0,0 +1,181 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+// compares writer, which tries uv_try_write before queueing, with awaiting every write
+// through uv_write and its callback, the path writer took before
+//
+//   couv_write_bench [port=9091] [duration=3] [size=64]
+//
+// A loopback sink in the same loop reads everything, both runs write size byte messages
+// back to back for duration seconds and await each one
+
+#include <couv.hpp>
+#include <hdr_histogram.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+struct options
+{
+    int port{9091};
+    uint64_t duration{3};  // seconds per run
+    std::size_t size{64};  // bytes per write
+};
+
+struct results
+{
+    hdr_histogram latency;  // nanoseconds
+    uint64_t writes{0};
+    uint64_t errors{0};
+};
+
+// one uv_write per message, resumed from the write callback on a later loop iteration
+class queued_write
+{
+    uv_write_t req{};
+    std::coroutine_handle<> co_handle;
+    int status{1};
+
+public:
+    queued_write(uv_stream_t* stream, std::string& message)
+    {
+        req.data = this;
+        uv_buf_t buf = uv_buf_init(message.data(), message.size());
+        status = uv_write(&req, stream, &buf, 1, [](uv_write_t* req, int status) {
+            auto self = static_cast<queued_write*>(req->data);
+            self->status = status;
+            self->co_handle.resume();
+        });
+        if (status == 0) {
+            status = 1;
+        }
+    }
+
+    bool await_ready() const noexcept { return status <= 0; }
+    void await_suspend(std::coroutine_handle<> h) noexcept { co_handle = h; }
+    couv::error_code await_resume() noexcept { return status; }
+};
+
+couv::task<> sink(couv::tcp& server, int connections)
+{
+    auto listner = server.listen(16);
+    for (int i = 0; i < connections; ++i) {
+        if (co_await listner) {
+            co_return std::exception_ptr{};
+        }
+        couv::tcp client;
+        if (server.accept(client)) {
+            co_return std::exception_ptr{};
+        }
+        auto reader = client.read();
+        while (co_await reader) {
+        }
+    }
+}
+
+couv::task<> queued(const options& opts, results& res)
+{
+    couv::tcp tcp;
+    if (co_await tcp.connect("127.0.0.1", opts.port, {.nodelay = true})) {
+        ++res.errors;
+        co_return std::exception_ptr{};
+    }
+    uv_tcp_t* raw = new uv_tcp_t;
+    uv_tcp_init(couv::current_loop(), raw);
+    uv_tcp_open(raw, tcp.detach());
+    auto stream = reinterpret_cast<uv_stream_t*>(raw);
+
+    std::string message(opts.size, 'x');
+    uint64_t end = uv_hrtime() + opts.duration * 1'000'000'000;
+    for (uint64_t now = uv_hrtime(); now < end; ) {
+        if (co_await queued_write{stream, message}) {
+            ++res.errors;
+            break;
+        }
+        uint64_t done = uv_hrtime();
+        res.latency.record(done - now);
+        ++res.writes;
+        now = done;
+    }
+    uv_close(reinterpret_cast<uv_handle_t*>(raw), [](uv_handle_t* handle) {
+        delete reinterpret_cast<uv_tcp_t*>(handle);
+    });
+}
+
+couv::task<> inline_first(const options& opts, results& res)
+{
+    couv::tcp tcp;
+    if (co_await tcp.connect("127.0.0.1", opts.port, {.nodelay = true})) {
+        ++res.errors;
+        co_return std::exception_ptr{};
+    }
+    std::string message(opts.size, 'x');
+    uint64_t end = uv_hrtime() + opts.duration * 1'000'000'000;
+    for (uint64_t now = uv_hrtime(); now < end; ) {
+        // borrowed like the uv_write run, so neither copies the message
+        if (co_await tcp.write(couv::buffer_chain{}.append(std::string_view{message}))) {
+            ++res.errors;
+            break;
+        }
+        uint64_t done = uv_hrtime();
+        res.latency.record(done - now);
+        ++res.writes;
+        now = done;
+    }
+}
+
+void report(const char* name, const results& res, const options& opts)
+{
+    std::printf("%-10s writes %10llu  errors %llu  %10.0f writes/s  p50 %lldns  p99 %lldns\n", name,
+        (unsigned long long)res.writes, (unsigned long long)res.errors, res.writes / double(opts.duration),
+        (long long)res.latency.percentile(50), (long long)res.latency.percentile(99));
+}
+
+couv::task<> run(const options& opts)
+{
+    couv::tcp server;
+    if (auto err = server.bind("127.0.0.1", opts.port)) {
+        std::fprintf(stderr, "bind: %s\n", uv_strerror(err));
+        co_return std::exception_ptr{};
+    }
+    auto sinks = sink(server, 2);
+
+    results before;
+    co_await queued(opts, before);
+    report("uv_write", before, opts);
+
+    results after;
+    co_await inline_first(opts, after);
+    report("writer", after, opts);
+
+    co_await sinks;
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = std::strchr(arg, '=');
+        if (!value) {
+            std::fprintf(stderr, "expected key=value, got %s\n", arg);
+            return 1;
+        }
+        std::string key{arg, value++};
+        if (key == "port") opts.port = std::atoi(value);
+        else if (key == "duration") opts.duration = std::strtoull(value, nullptr, 10);
+        else if (key == "size") opts.size = std::max<std::size_t>(1, std::strtoull(value, nullptr, 10));
+        else {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    auto task = run(opts);
+    couv::loop();
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Copyright (C) 2021 Ghita Catalin Mihai
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// high dynamic range histogram, log buckets split linearly to keep 3 significant digits
+class hdr_histogram
+{
+    static constexpr int sub_bucket_half_magnitude = 10;
+    static constexpr int64_t sub_bucket_count = int64_t{1} << (sub_bucket_half_magnitude + 1);
+    static constexpr int64_t sub_bucket_half = sub_bucket_count / 2;
+    static constexpr int64_t sub_bucket_mask = sub_bucket_count - 1;
+
+    std::vector<uint64_t> counts;
+    int64_t highest;
+    uint64_t total{0};
+    int64_t min_value{INT64_MAX};
+    int64_t max_value{0};
+    double sum{0};
+
+    static int bucket_of(int64_t value) noexcept
+    {
+        int pow2ceiling = 64 - std::countl_zero(static_cast<uint64_t>(value | sub_bucket_mask));
+        return pow2ceiling - (sub_bucket_half_magnitude + 1);
+    }
+
+    static std::size_t index_of(int64_t value) noexcept
+    {
+        int bucket = bucket_of(value);
+        int64_t sub_bucket = value >> bucket;
+        return ((bucket + 1) << sub_bucket_half_magnitude) + (sub_bucket - sub_bucket_half);
+    }
+
+    // highest value that lands in the same slot as index
+    static int64_t value_of(std::size_t index) noexcept
+    {
+        int bucket = static_cast<int>(index >> sub_bucket_half_magnitude) - 1;
+        int64_t sub_bucket = (index & (sub_bucket_half - 1)) + sub_bucket_half;
+        if (bucket < 0) {
+            sub_bucket -= sub_bucket_half;
+            bucket = 0;
+        }
+        return ((sub_bucket + 1) << bucket) - 1;
+    }
+
+public:
+    // values above highest are clamped to it
+    explicit hdr_histogram(int64_t highest = 3'600'000'000) :
+        counts(index_of(highest) + 1), highest{highest} {}
+
+    void record(int64_t value, uint64_t count = 1) noexcept
+    {
+        value = std::clamp<int64_t>(value, 0, highest);
+        counts[index_of(value)] += count;
+        total += count;
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+        sum += static_cast<double>(value) * count;
+    }
+
+    void merge(const hdr_histogram& h) noexcept
+    {
+        for (std::size_t i = 0; i < h.counts.size() && i < counts.size(); ++i) {
+            counts[i] += h.counts[i];
+        }
+        total += h.total;
+        min_value = std::min(min_value, h.min_value);
+        max_value = std::max(max_value, h.max_value);
+        sum += h.sum;
+    }
+
+    uint64_t count() const noexcept { return total; }
+    int64_t min() const noexcept { return total ? min_value : 0; }
+    int64_t max() const noexcept { return max_value; }
+    double mean() const noexcept { return total ? sum / total : 0; }
+
+    int64_t percentile(double p) const noexcept
+    {
+        if (!total) {
+            return 0;
+        }
+        auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * total)));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(value_of(i), max_value);
+            }
+        }
+        return max_value;
+    }
+};